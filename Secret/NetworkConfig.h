@@ -14,7 +14,46 @@
 #define INIT_UUID_MATCH         { 0x32, 0x10 } // regulate the node get provitioned
 
 #define DEFAULT_MSG_SEND_TTL    2 // default value for message ttl, ttl changeable in runtime from command
-#define MSG_TIMEOUT             0
+#define MESH_EDGE_SEND_TTL      7 // ttl edges send with, hops to a node = this - received ttl, must match edge and exceed the network diameter
+#define MESH_TTL_MARGIN         1 // ttl added over the learned hop count, covers one extra relay on a changed path
+#define MSG_TIMEOUT             0 // client response timeout (ms) for nodes without response time samples, 0 is stack default
+#define MESH_RTO_MIN_MS         250 // response timeout learned per node stays in this range
+#define MESH_RTO_MAX_MS         20000
+#define MESH_RTO_MAX_BACKOFF    6   // timeouts in a row doubling the learned timeout, until the next sample
+#define MESH_MSG_MAX_LEN        (ESP_BLE_MESH_SDU_MAX_LEN - 7) // vendor message payload, after 3 byte opcode and 4 byte TransMIC
+#define MESH_FANOUT_MAX_DST     128 // destinations in one multi-destination send
+#define MESH_FANOUT_INTERVAL_MS 40  // gap per advertising segment between fan-out sends, covers the net_transmit repeats
+#define MESH_GROUP_MAX_MEMBERSHIPS 128 // (group, node) pairs tracked by root, a node in 2 groups takes 2
+#define MESH_GROUP_MAX_RETRIES  3   // subscription change resent this many times on timeout, then reported failed
+#define MESH_TAGGED_MAX_INFLIGHT 32 // host tagged sends waiting for their outcome
+#define MESH_TX_QUEUE_LEN       16  // sends waiting for admission to the advertising bearer, plus those handed to the stack
+#define MESH_TX_QUEUE_XOFF      12  // queued sends at which host is told to pause
+#define MESH_TX_QUEUE_XON       4   // queued sends at which host is told to resume
+#define MESH_TX_BURST_SEGMENTS  10  // segments sent back to back, each takes one of the CONFIG_BLE_MESH_ADV_BUF_COUNT adv buffers
+#define MESH_TX_MAX_BACKOFF     8   // segment spacing grows up to MESH_FANOUT_INTERVAL_MS times this while stack is out of buffers
+#define MESH_TX_MAX_RETRIES     3   // re-queues of a send the stack failed for lack of buffers
+#define MESH_TX_HOLD_MIN_MS     3000 // least a send refused for a pending request to its node is held, if no response or timeout frees it first
+#define MESH_XFER_CHUNK_LEN     96  // payload bytes per chunk of a large transfer, 10 advertising segments with header, opcode and MIC
+#define MESH_XFER_WINDOW        8   // chunks sent ahead of the node's ack, root buffers only this many (max 9, bitmap is 8 bit)
+#define MESH_XFER_ACK_TIMEOUT_MS 2000 // no ack in time after the ack request chunk went out, root resends the chunks the node is missing
+#define MESH_XFER_MAX_RETRIES   5   // ack timeouts in a row before the transfer fails
+#define MESH_IMPORTANT_MAX_INFLIGHT 32 // important messages tracked until acked, matched by (node, sequence)
+#define MESH_IMPORTANT_TIMEOUT_MS 3000 // no ack in time, important message is sent again, doubles per retransmit
+#define MESH_IMPORTANT_MAX_RETRANSMIT 3 // retransmits before an important message is given up, 1 more ttl per 2
+#define MESH_RETX_TICK_MS       50  // retransmit timer wheel resolution
+#define MESH_RETX_WHEEL_SLOTS   64  // wheel turn of 3.2 s, longer timeouts wait whole turns
+#define MESH_RETX_MAX_TIMEOUT_MS 24000 // ack timeout stops doubling here
+#define MESH_RETX_JITTER_PERCENT 25 // up to this share of the timeout is added at random
+#define MESH_RETX_MAX_PER_TICK  2   // retransmits per tick, more timing out together are spread over the next ticks
+#define MESH_DEDUP_CACHE_SIZE   32  // (node, sequence) of important messages received lately, a repeat is acked but not delivered
+#define MESH_DEDUP_EXPIRY_MS    30000 // longer than an edge keeps retransmitting, then the sequence may come again
+#define MESH_ACK_AGGREGATE_MS   50  // acks of important messages from one node within this window go out as one ACK_I, 0 acks each with RESPONSE_I
+#define MESH_ACK_AGGREGATE_NODES 8  // nodes with acks waiting at once, more are acked one by one
+#define MESH_OUTBOX_ENABLED     1   // journal important messages in nvs, messages not acked before a restart are sent again
+#define MESH_OUTBOX_FLUSH_MS    2000 // journal changes are written together this long after the first one, acked by then never hits flash
+#define MESH_POOL_SMALL_BLOCK   64  // important message buffer (with sequence) fitting this comes from the small pool
+#define MESH_POOL_SMALL_COUNT   MESH_IMPORTANT_MAX_INFLIGHT
+#define MESH_POOL_LARGE_COUNT   8   // buffers of up to MESH_MSG_MAX_LEN, also taken when the small pool is empty
 #define MSG_ROLE_ROOT           ROLE_PROVISIONER
 #define MSG_ROLE_EDGE           ROLE_NODE
 // #define MSG_ROLE_EDGE       ROLE_NODE // ROLE_FAST_PROV // ROLE_NODE
@@ -43,6 +82,11 @@
 #define ECS_193_MODEL_OP_RESPONSE_I_0    ESP_BLE_MESH_MODEL_OP_3(0x0b, ECS_193_CID)
 #define ECS_193_MODEL_OP_RESPONSE_I_1    ESP_BLE_MESH_MODEL_OP_3(0x0c, ECS_193_CID)
 #define ECS_193_MODEL_OP_RESPONSE_I_2    ESP_BLE_MESH_MODEL_OP_3(0x0d, ECS_193_CID)
+#define ECS_193_MODEL_OP_CHUNK          ESP_BLE_MESH_MODEL_OP_3(0x0e, ECS_193_CID) // | transfer id | flags | 2 byte index | 2 byte count | data |
+#define ECS_193_MODEL_OP_CHUNK_ACK      ESP_BLE_MESH_MODEL_OP_3(0x0f, ECS_193_CID) // | transfer id | 2 byte next expected index | bitmap |
+#define ECS_193_MODEL_OP_MESSAGE_I      ESP_BLE_MESH_MODEL_OP_3(0x10, ECS_193_CID) // | 2 byte sequence | message |, acked with RESPONSE_I
+#define ECS_193_MODEL_OP_RESPONSE_I     ESP_BLE_MESH_MODEL_OP_3(0x11, ECS_193_CID) // | 2 byte sequence | response |
+#define ECS_193_MODEL_OP_ACK_I          ESP_BLE_MESH_MODEL_OP_3(0x12, ECS_193_CID) // | 2 byte first sequence | 2 byte bitmap |, bit i acks first + i
 
 
 #define NVS_KEY_ROOT "ECS_193_client"
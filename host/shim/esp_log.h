@@ -0,0 +1,20 @@
+/* esp_log.h - ESP-IDF log macros for the host build */
+
+#include <stdio.h>
+
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+// logs cost more than the code under benchmark, only printed with -DUART_HOST_VERBOSE=ON
+#ifdef UART_HOST_VERBOSE
+#define ESP_HOST_LOG(level, tag, format, ...) fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__)
+#else
+#define ESP_HOST_LOG(level, tag, format, ...) do { if (0) fprintf(stderr, "%s" format, tag, ##__VA_ARGS__); } while (0) // format still checked
+#endif
+
+#define ESP_LOGE(tag, format, ...) ESP_HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_HOST_LOG("D", tag, format, ##__VA_ARGS__)
+
+#endif /* _HOST_ESP_LOG_H_ */
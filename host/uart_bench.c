@@ -0,0 +1,419 @@
+/* uart_bench.c - Host benchmark of the host link codec, transport and command dispatcher */
+
+/*
+ * uart_bench              run every benchmark on the loopback transport
+ * uart_bench --pty        serve commands on a pseudo terminal, escape byte framing
+ * uart_bench --pty-cobs   same with COBS framing
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "uart_codec.h"
+#include "uart_command.h"
+#include "uart_host.h"
+
+#define BENCH_BUF_SIZE 1024         // same as UART_BUF_SIZE on target
+#define BENCH_READ_CHUNK 120        // uart rx fifo full threshold on target
+#define BENCH_LOOPBACK_SIZE (64 * 1024)
+#define BENCH_BYTES_PER_RUN (8 * 1024 * 1024)
+#define BENCH_COMMAND_ITERATIONS 1000000
+
+static uint8_t payload[BENCH_BUF_SIZE];
+static uint8_t frame[UART_FRAME_MAX_LEN(BENCH_BUF_SIZE + UART_SEQ_TRAILER_LEN)];
+static uint8_t staging[4 * sizeof(frame)];
+static uint8_t decoded[BENCH_BUF_SIZE + 2 + UART_SEQ_TRAILER_LEN];
+static uint8_t chunk[BENCH_READ_CHUNK];
+
+static size_t frames_decoded = 0;
+static size_t commands_executed = 0;
+
+static uart_transport_t serve_transport;
+static bool serve_cobs = false;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_payload(const char* profile, size_t length) {
+    uint32_t seed = 0x12345678;
+
+    for (size_t i = 0; i < length; i++) {
+        if (strcmp(profile, "ascii") == 0) {
+            payload[i] = 'a' + i % 26;
+        } else if (strcmp(profile, "binary") == 0) {
+            seed = seed * 1664525 + 1013904223;
+            payload[i] = seed >> 24;
+        } else {
+            payload[i] = 0xFF;
+        }
+    }
+}
+
+static int encode(bool cobs, bool seq, uint8_t seq_num, size_t length, uint8_t* out, size_t out_size) {
+    if (cobs) {
+        uint8_t trailer[UART_SEQ_TRAILER_LEN];
+        if (seq) {
+            uart_seq_trailer(1, seq_num, payload, length, trailer);
+        }
+        return uart_encode_cobs_frame(1, payload, length, trailer, seq ? UART_SEQ_TRAILER_LEN : 0, out, out_size);
+    }
+    if (seq) {
+        return uart_encode_seq_frame(1, seq_num, payload, length, out, out_size);
+    }
+    return uart_encode_frame(1, payload, length, out, out_size);
+}
+
+// ======================== Stub Command Actions ========================
+static int stub_reply(uint16_t node_addr, uint8_t* data, size_t length) {
+    return length;
+}
+static void stub_void(void) {
+    commands_executed++;
+}
+static void stub_send(uint16_t node_addr, uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static void stub_tagged_send(uint16_t request_id, uint16_t node_addr, bool require_response, uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static void stub_multi_send(uint16_t* node_addrs, uint8_t node_count, uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static void stub_group_members(uint16_t group_addr, uint16_t* node_addrs, uint16_t node_count) {
+    commands_executed++;
+}
+static void stub_group_send(uint16_t group_addr, uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static void stub_transfer_open(uint16_t node_addr, uint32_t total_length) {
+    commands_executed++;
+}
+static void stub_transfer_write(uint32_t offset, uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static void stub_node_ttl(uint16_t node_addr, uint8_t ttl) {
+    commands_executed++;
+}
+static void stub_outbox(uint8_t action) {
+    commands_executed++;
+}
+static void stub_net_delta(uint32_t epoch, uint32_t since_version) {
+    commands_executed++;
+}
+static void stub_node_query(uint16_t cursor, uint16_t fields, uint8_t max_nodes) {
+    commands_executed++;
+}
+static void stub_broadcast(uint16_t length, uint8_t* data) {
+    commands_executed++;
+}
+static int stub_baud(uint32_t baud_rate, bool hw_flow_ctrl) {
+    commands_executed++;
+    return 0;
+}
+static int stub_confirm(void) {
+    commands_executed++;
+    return 0;
+}
+static int stub_link_mode(uint8_t mode) {
+    commands_executed++;
+    return 0;
+}
+
+static const uart_command_ops_t stub_ops = {
+    .reply = stub_reply,
+    .send_network_info = stub_void,
+    .send_pool_stats = stub_void,
+    .outbox = stub_outbox,
+    .send_network_delta = stub_net_delta,
+    .send_node_query = stub_node_query,
+    .send_message = stub_send,
+    .send_tagged_message = stub_tagged_send,
+    .send_multi_message = stub_multi_send,
+    .broadcast_message = stub_broadcast,
+    .add_group_members = stub_group_members,
+    .delete_group_members = stub_group_members,
+    .send_group_message = stub_group_send,
+    .transfer_open = stub_transfer_open,
+    .transfer_write = stub_transfer_write,
+    .transfer_abort = stub_void,
+    .set_node_ttl = stub_node_ttl,
+    .restart = stub_void,
+    .reset_network = stub_void,
+    .request_baud_rate = stub_baud,
+    .confirm_baud_rate = stub_confirm,
+    .set_link_mode = stub_link_mode,
+    .benchmark = stub_void,
+};
+
+static void count_frame(uint8_t* data, size_t length) {
+    frames_decoded++;
+}
+
+static void execute_frame(uint8_t* data, size_t length) {
+    frames_decoded++;
+    uart_command_execute(data, length);
+}
+
+static void drain(const uart_transport_t* transport, uart_decoder_t* decoder, void (*frame_handler)(uint8_t* frame, size_t length)) {
+    int read_len;
+    while ((read_len = transport->read(transport->ctx, chunk, sizeof(chunk), 0)) > 0) {
+        uart_decoder_feed(decoder, chunk, read_len, frame_handler);
+    }
+}
+
+// ======================== Write Strategies ========================
+// per byte: one transport write per encoded byte, as uart_sendData did before frames were staged
+// per frame: one write per encoded frame
+// batched: frames staged back to back and written together, as uart_tx_task does
+static void bench_write_path(void) {
+    static const size_t sizes[] = { 16, 64, 256, 1024 };
+    static const char* strategies[] = { "per byte", "per frame", "batched" };
+
+    printf("\n== write path, escape framing, ascii payload, loopback, full decode ==\n");
+    printf("%-10s %7s %12s %12s %12s\n", "strategy", "payload", "writes/frame", "frames/s", "MB/s");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int strategy = 0; strategy < 3; strategy++) {
+            uart_transport_t transport;
+            uart_loopback_t loopback;
+            uart_decoder_t decoder;
+            size_t frames = BENCH_BYTES_PER_RUN / sizes[s] / (strategy == 0 ? 8 : 1); // per byte is slow
+            size_t staged = 0;
+
+            uart_loopback_open(&transport, &loopback, BENCH_LOOPBACK_SIZE);
+            uart_decoder_init(&decoder, decoded, sizeof(decoded));
+            fill_payload("ascii", sizes[s]);
+            frames_decoded = 0;
+
+            double start = now_s();
+            for (size_t i = 0; i < frames; i++) {
+                if (strategy == 2) {
+                    if (staged + UART_FRAME_MAX_LEN(sizes[s]) > sizeof(staging)) {
+                        transport.write(transport.ctx, staging, staged);
+                        staged = 0;
+                        drain(&transport, &decoder, count_frame);
+                    }
+                    staged += encode(false, false, 0, sizes[s], staging + staged, sizeof(staging) - staged);
+                    continue;
+                }
+
+                int frame_len = encode(false, false, 0, sizes[s], frame, sizeof(frame));
+                if (strategy == 0) {
+                    for (int b = 0; b < frame_len; b++) {
+                        transport.write(transport.ctx, frame + b, 1);
+                    }
+                } else {
+                    transport.write(transport.ctx, frame, frame_len);
+                }
+                drain(&transport, &decoder, count_frame);
+            }
+            if (staged > 0) {
+                transport.write(transport.ctx, staging, staged);
+            }
+            drain(&transport, &decoder, count_frame);
+            double elapsed = now_s() - start;
+
+            printf("%-10s %7zu %12.3f %12.0f %12.1f%s\n", strategies[strategy], sizes[s],
+                   (double) loopback.write_calls / frames, frames / elapsed, frames * sizes[s] / elapsed / 1e6,
+                   frames_decoded == frames ? "" : "  DECODE MISMATCH");
+            uart_loopback_close(&loopback);
+        }
+    }
+}
+
+// ======================== Framing Modes ========================
+static void bench_framing(void) {
+    static const char* profiles[] = { "ascii", "binary", "0xff" };
+    static const char* modes[] = { "escape", "escape+seq", "cobs", "cobs+seq" };
+    const size_t length = 256;
+    const size_t frames = BENCH_BYTES_PER_RUN / length;
+
+    printf("\n== framing modes, %zu byte payload ==\n", length);
+    printf("%-8s %-11s %9s %14s %14s %14s %14s\n", "profile", "mode", "overhead", "enc frames/s", "enc MB/s", "dec frames/s", "dec MB/s");
+
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        fill_payload(profiles[p], length);
+        for (int mode = 0; mode < 4; mode++) {
+            bool cobs = (mode >= 2);
+            bool seq = (mode % 2 == 1);
+            uart_decoder_t decoder;
+            int frame_len = 0;
+
+            double start = now_s();
+            for (size_t i = 0; i < frames; i++) {
+                frame_len = encode(cobs, seq, i, length, frame, sizeof(frame));
+            }
+            double encode_s = now_s() - start;
+
+            uart_decoder_init(&decoder, decoded, sizeof(decoded));
+            uart_decoder_set_mode(&decoder, cobs ? UART_LINK_MODE_COBS : UART_LINK_MODE_PLAIN);
+            frames_decoded = 0;
+            start = now_s();
+            for (size_t i = 0; i < frames; i++) {
+                uart_decoder_feed(&decoder, frame, frame_len, count_frame);
+            }
+            double decode_s = now_s() - start;
+
+            printf("%-8s %-11s %8.1f%% %14.0f %14.1f %14.0f %14.1f%s\n", profiles[p], modes[mode],
+                   100.0 * (frame_len - (int) length) / length,
+                   frames / encode_s, frames * length / encode_s / 1e6,
+                   frames / decode_s, frames * length / decode_s / 1e6,
+                   frames_decoded == frames ? "" : "  DECODE MISMATCH");
+        }
+    }
+}
+
+// ======================== Command Dispatch ========================
+static void bench_commands(void) {
+    static const struct {
+        const char* name;
+        const char* command;
+        size_t length;
+    } commands[] = {
+        { "NINFO", CMD_GET_NET_INFO, CMD_LEN },
+        { "SEND-", CMD_SEND_MSG "\x00\x05" "hello node", CMD_LEN + 2 + 10 },
+        { "SENDT", CMD_TAGGED_SEND_MSG "\x00\x01\x00\x00\x05" "hello node", CMD_LEN + 5 + 10 },
+        { "MSEND", CMD_MULTI_SEND_MSG "\x03\x00\x05\x00\x06\x00\x07" "hello nodes", CMD_LEN + 1 + 6 + 11 },
+        { "GSEND", CMD_GROUP_SEND_MSG "\xc0\x01" "hello zone", CMD_LEN + 2 + 10 },
+        { "XDATA", CMD_TRANSFER_DATA "\x00\x00\x01\x00" "chunk data", CMD_LEN + 4 + 10 },
+        { "BCAST", CMD_BROADCAST_MSG "\x00\x00" "hello all", CMD_LEN + 2 + 9 },
+        { "BAUDC", CMD_CONFIRM_BAUD_RATE, CMD_LEN },
+        { "LINK-", CMD_SET_LINK_MODE "\x02", CMD_LEN + 1 },
+        { "BENCH", CMD_CODEC_BENCHMARK, CMD_LEN },
+        { "unknown", "XXXXX", CMD_LEN },
+    };
+    uint8_t command[64];
+
+    printf("\n== command dispatch, stub actions ==\n");
+    printf("%-8s %12s\n", "command", "ns/command");
+
+    uart_command_init(&stub_ops);
+    for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++) {
+        memcpy(command, commands[c].command, commands[c].length);
+        commands_executed = 0;
+
+        double start = now_s();
+        for (size_t i = 0; i < BENCH_COMMAND_ITERATIONS; i++) {
+            uart_command_execute(command, commands[c].length);
+        }
+        double elapsed = now_s() - start;
+
+        printf("%-8s %12.1f\n", commands[c].name, elapsed * 1e9 / BENCH_COMMAND_ITERATIONS);
+    }
+}
+
+// ======================== End to End ========================
+// host side encode, loopback, fifo sized reads, decode and dispatch of SEND- commands
+static void bench_end_to_end(void) {
+    static const size_t sizes[] = { 16, 64, 256 };
+
+    printf("\n== end to end SEND- over loopback ==\n");
+    printf("%-7s %7s %12s %12s\n", "framing", "payload", "frames/s", "MB/s");
+
+    uart_command_init(&stub_ops);
+    for (int cobs = 0; cobs < 2; cobs++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uart_transport_t transport;
+            uart_loopback_t loopback;
+            uart_decoder_t decoder;
+            size_t length = sizes[s];
+            size_t frames = BENCH_BYTES_PER_RUN / length;
+
+            // SEND- | 2 byte addr | message, encoded as a frame whose "node address" is the verb head
+            fill_payload("ascii", length + CMD_LEN + 2);
+            memcpy(payload, CMD_SEND_MSG "\x00\x05", CMD_LEN + 2);
+
+            uart_loopback_open(&transport, &loopback, BENCH_LOOPBACK_SIZE);
+            uart_decoder_init(&decoder, decoded, sizeof(decoded));
+            uart_decoder_set_mode(&decoder, cobs ? UART_LINK_MODE_COBS : UART_LINK_MODE_PLAIN);
+            frames_decoded = 0;
+            commands_executed = 0;
+
+            double start = now_s();
+            for (size_t i = 0; i < frames; i++) {
+                int frame_len;
+                // uart_encode_frame prepends a node address, host frames start with the command instead
+                if (cobs) {
+                    frame_len = uart_encode_cobs_frame(ntohs(*(uint16_t*) payload), payload + 2, length + CMD_LEN, NULL, 0, frame, sizeof(frame));
+                } else {
+                    frame_len = uart_encode_frame(ntohs(*(uint16_t*) payload), payload + 2, length + CMD_LEN, frame, sizeof(frame));
+                }
+                transport.write(transport.ctx, frame, frame_len);
+                drain(&transport, &decoder, execute_frame);
+            }
+            double elapsed = now_s() - start;
+
+            printf("%-7s %7zu %12.0f %12.1f%s\n", cobs ? "cobs" : "escape", length,
+                   frames / elapsed, frames * length / elapsed / 1e6,
+                   commands_executed == frames ? "" : "  DISPATCH MISMATCH");
+            uart_loopback_close(&loopback);
+        }
+    }
+}
+
+// ======================== PTY Server ========================
+static int serve_reply(uint16_t node_addr, uint8_t* data, size_t length) {
+    int frame_len = (serve_cobs ?
+                     uart_encode_cobs_frame(node_addr, data, length, NULL, 0, frame, sizeof(frame)) :
+                     uart_encode_frame(node_addr, data, length, frame, sizeof(frame)));
+    if (frame_len < 0) {
+        return -1;
+    }
+    return serve_transport.write(serve_transport.ctx, frame, frame_len);
+}
+
+static void serve_frame(uint8_t* data, size_t length) {
+    printf("frame %zu bytes: %.*s\n", length, (int) length, (char*) data);
+    fflush(stdout);
+    uart_command_execute(data, length);
+}
+
+static int serve_pty(bool cobs) {
+    uart_command_ops_t ops = stub_ops;
+    uart_decoder_t decoder;
+    char slave_name[128];
+
+    if (uart_pty_open(&serve_transport, slave_name, sizeof(slave_name)) != 0) {
+        perror("uart_pty_open");
+        return 1;
+    }
+    serve_cobs = cobs;
+    ops.reply = serve_reply;
+    uart_command_init(&ops);
+    uart_decoder_init(&decoder, decoded, sizeof(decoded));
+    uart_decoder_set_mode(&decoder, cobs ? UART_LINK_MODE_COBS : UART_LINK_MODE_PLAIN);
+
+    printf("serving %s framing on %s\n", cobs ? "cobs" : "escape", slave_name);
+    fflush(stdout);
+    while (1) {
+        int read_len = serve_transport.read(serve_transport.ctx, chunk, sizeof(chunk), 1000);
+        if (read_len < 0) {
+            break;
+        }
+        uart_decoder_feed(&decoder, chunk, read_len, serve_frame);
+    }
+
+    uart_pty_close(&serve_transport);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--pty") == 0) {
+        return serve_pty(false);
+    }
+    if (argc > 1 && strcmp(argv[1], "--pty-cobs") == 0) {
+        return serve_pty(true);
+    }
+
+    bench_write_path();
+    bench_framing();
+    bench_commands();
+    bench_end_to_end();
+    return 0;
+}
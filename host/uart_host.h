@@ -0,0 +1,42 @@
+/* uart_host.h - Host backends of uart_transport_t */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "uart_transport.h"
+
+#ifndef _UART_HOST_H_
+#define _UART_HOST_H_
+
+typedef struct {
+    uint8_t* buffer;
+    size_t capacity;
+    size_t head;        // total bytes written
+    size_t tail;        // total bytes read
+    size_t write_calls; // write() invocations, to compare write strategies
+} uart_loopback_t;
+
+/**
+ * @brief Create an in-memory loopback, bytes written are read back in order.
+ * 
+ * @param transport Output, transport bound to the loopback.
+ * @param loopback Loopback state, must outlive the transport.
+ * @param capacity Max bytes buffered, writes beyond are truncated.
+ * @return 0 on success, -1 if out of memory.
+ */
+int uart_loopback_open(uart_transport_t* transport, uart_loopback_t* loopback, size_t capacity);
+
+void uart_loopback_close(uart_loopback_t* loopback);
+
+/**
+ * @brief Open a pseudo terminal, a host tool connects to the slave side as if it were the root uart.
+ * 
+ * @param transport Output, transport on the master side.
+ * @param slave_name Output, path of the slave device.
+ * @param name_size Size of slave_name.
+ * @return 0 on success, -1 on error.
+ */
+int uart_pty_open(uart_transport_t* transport, char* slave_name, size_t name_size);
+
+void uart_pty_close(uart_transport_t* transport);
+
+#endif /* _UART_HOST_H_ */
@@ -0,0 +1,64 @@
+/* uart_transport_loopback.c - In-memory loopback transport */
+
+#include <stdlib.h>
+#include <string.h>
+#include "uart_host.h"
+
+static int loopback_write(void* ctx, const uint8_t* data, size_t length) {
+    uart_loopback_t* loopback = ctx;
+    size_t space = loopback->capacity - (loopback->head - loopback->tail);
+    size_t write_len = (length < space ? length : space);
+
+    loopback->write_calls++;
+    for (size_t i = 0; i < write_len; ) {
+        size_t offset = (loopback->head + i) % loopback->capacity;
+        size_t chunk = loopback->capacity - offset;
+        if (chunk > write_len - i) {
+            chunk = write_len - i;
+        }
+        memcpy(loopback->buffer + offset, data + i, chunk);
+        i += chunk;
+    }
+    loopback->head += write_len;
+    return write_len;
+}
+
+// never blocks, nothing else can write while the caller waits
+static int loopback_read(void* ctx, uint8_t* data, size_t length, uint32_t timeout_ms) {
+    uart_loopback_t* loopback = ctx;
+    size_t available = loopback->head - loopback->tail;
+    size_t read_len = (length < available ? length : available);
+
+    for (size_t i = 0; i < read_len; ) {
+        size_t offset = (loopback->tail + i) % loopback->capacity;
+        size_t chunk = loopback->capacity - offset;
+        if (chunk > read_len - i) {
+            chunk = read_len - i;
+        }
+        memcpy(data + i, loopback->buffer + offset, chunk);
+        i += chunk;
+    }
+    loopback->tail += read_len;
+    return read_len;
+}
+
+int uart_loopback_open(uart_transport_t* transport, uart_loopback_t* loopback, size_t capacity) {
+    loopback->buffer = malloc(capacity);
+    if (loopback->buffer == NULL) {
+        return -1;
+    }
+    loopback->capacity = capacity;
+    loopback->head = 0;
+    loopback->tail = 0;
+    loopback->write_calls = 0;
+
+    transport->write = loopback_write;
+    transport->read = loopback_read;
+    transport->ctx = loopback;
+    return 0;
+}
+
+void uart_loopback_close(uart_loopback_t* loopback) {
+    free(loopback->buffer);
+    loopback->buffer = NULL;
+}
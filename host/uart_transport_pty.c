@@ -0,0 +1,75 @@
+/* uart_transport_pty.c - Pseudo terminal transport */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "uart_host.h"
+
+static int pty_write(void* ctx, const uint8_t* data, size_t length) {
+    int fd = (int) (intptr_t) ctx;
+    size_t written = 0;
+
+    while (written < length) {
+        ssize_t ret = write(fd, data + written, length - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += ret;
+    }
+    return written;
+}
+
+static int pty_read(void* ctx, uint8_t* data, size_t length, uint32_t timeout_ms) {
+    int fd = (int) (intptr_t) ctx;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0) {
+        return ret; // timeout or error
+    }
+
+    ssize_t read_len = read(fd, data, length);
+    if (read_len < 0 && errno == EIO) {
+        return 0; // no slave side open yet
+    }
+    return read_len;
+}
+
+int uart_pty_open(uart_transport_t* transport, char* slave_name, size_t name_size) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (grantpt(fd) != 0 || unlockpt(fd) != 0 || ptsname(fd) == NULL) {
+        close(fd);
+        return -1;
+    }
+    strncpy(slave_name, ptsname(fd), name_size - 1);
+    slave_name[name_size - 1] = '\0';
+
+    // raw bytes, the framing bytes must not be touched by the line discipline
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    transport->write = pty_write;
+    transport->read = pty_read;
+    transport->ctx = (void*) (intptr_t) fd;
+    return 0;
+}
+
+void uart_pty_close(uart_transport_t* transport) {
+    close((int) (intptr_t) transport->ctx);
+}
@@ -3,9 +3,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_random.h"
 #include "board.h"
 #include "ble_mesh_config_root.h"
+#include "mesh_wheel.h"
 #include "../Secret/NetworkConfig.h"
 
 #define TAG TAG_ROOT
@@ -14,9 +20,6 @@
 
 
 static bool provision_enable = true;
-static uint8_t** important_message_data_list = NULL;
-static uint16_t important_message_data_lengths[] = {0, 0, 0};
-static uint8_t important_message_retransmit_times[] = {0, 0, 0};
 
 //maybe will move it to networkConfig.h, TB Finish
 #define COMP_DATA_1_OCTET(msg, offset)      (msg[offset])
@@ -28,17 +31,6 @@ static uint16_t cur_rpr_cli_opcode;
 static uint16_t remote_rpr_srv_addr = 0;
 uint8_t message_tid = 0;
 
-typedef struct {
-    uint8_t  uuid[16];
-    uint16_t unicast;
-    uint8_t  elem_num;
-    uint8_t  onoff;
-    uint8_t *sig_model_num;
-    uint8_t *vnd_model_num;
-    uint16_t **sig_models;
-    uint32_t **vnd_models;
-} esp_ble_mesh_node_info_t;
-
 static uint8_t dev_uuid[ESP_BLE_MESH_OCTET16_LEN];
 static struct esp_ble_mesh_key {
     uint16_t net_idx;
@@ -53,6 +45,225 @@ static esp_ble_mesh_node_info_t nodes[CONFIG_BLE_MESH_MAX_PROV_NODES] = {
     }
 };
 
+// topology version, bumped on every node change so host can ask only for the changes since the version it has
+static uint32_t topology_version = 0;
+static uint32_t topology_floor = 0; // removed nodes up to this version were dropped from nodes[], older hosts need a full table
+static uint32_t topology_epoch = 0; // random per boot, versions from another boot don't compare
+static void topology_remove_node(esp_ble_mesh_node_info_t *node);
+static esp_ble_mesh_node_info_t *topology_find_uuid(const uint8_t uuid[16]);
+
+// one multi-destination send at a time, payload copied so the uart frame can be reused
+static struct {
+    volatile bool active;
+    uint16_t dst_addresses[MESH_FANOUT_MAX_DST];
+    uint8_t results[MESH_FANOUT_MAX_DST];
+    uint8_t dst_count;
+    uint8_t index;
+    uint8_t outstanding; // destinations in the tx queue whose outcome has not come back yet
+    uint8_t data[MESH_MSG_MAX_LEN];
+    uint16_t length;
+    uint64_t interval_us;
+    uint8_t generation; // tags sends with the fan-out they belong to, late outcomes of an earlier one are dropped
+    void (*complete_handler)(const uint16_t *dst_addresses, const uint8_t *results, uint8_t dst_count);
+} fanout;
+static portMUX_TYPE fanout_lock = portMUX_INITIALIZER_UNLOCKED; // sends from the timer task, outcomes from the btc task
+static esp_timer_handle_t fanout_timer = NULL;
+static void fanout_send_outcome(uint16_t tag, uint8_t status);
+
+// host tagged sends waiting for their outcome from the mesh stack
+#define TAGGED_FREE             0
+#define TAGGED_WAIT_SEND        1 // in the tx queue or waiting for ESP_BLE_MESH_MODEL_SEND_COMP_EVT
+#define TAGGED_WAIT_RESPONSE    2 // sent, waiting for response or client timeout
+
+typedef struct {
+    uint16_t request_id;
+    uint16_t dst_address;
+    int64_t  start_time;
+    uint8_t  state;
+    bool     require_response;
+    void (*complete_handler)(uint16_t request_id, uint16_t dst_address, uint8_t status, uint32_t latency_us);
+} tagged_send_t;
+
+static tagged_send_t tagged_sends[MESH_TAGGED_MAX_INFLIGHT];
+static portMUX_TYPE tagged_lock = portMUX_INITIALIZER_UNLOCKED; // sends from dispatch task, outcomes from the btc task
+static void tagged_send_outcome(uint16_t slot, uint8_t status);
+
+// admission control in front of every unicast and broadcast send, a token bucket of advertising segments
+// (GCRA form) paces the stack so a host burst waits here instead of failing on exhausted tx buffers
+#define TX_ENTRY_FREE           0
+#define TX_ENTRY_QUEUED         1
+#define TX_ENTRY_SENDING        2 // handed to the stack, waiting for ESP_BLE_MESH_MODEL_SEND_COMP_EVT
+
+// the stack reports a send only by (dst, opcode), the queue matches it once and hands the outcome to the owner
+#define TX_OWNER_PLAIN          0 // send_message()/broadcast_message(), failures reported to host as text
+#define TX_OWNER_TAGGED         1 // tag is the tagged_sends slot
+#define TX_OWNER_FANOUT         2 // tag is the fan-out generation and destination index
+#define TX_OWNER_XFER           3 // tag is the chunk index, lost chunks are recovered by the transfer
+
+typedef struct {
+    uint16_t dst_address;
+    uint32_t opcode;
+    uint32_t seq;       // admission order, oldest queued entry is sent first
+    uint16_t length;
+    uint8_t  state;
+    uint8_t  retries;
+    uint8_t  owner;
+    uint16_t tag;
+    int64_t  hold_until; // stack refused it with -EBUSY, kept back until the node's pending request ends
+    bool     require_response;
+    uint8_t  data[MESH_MSG_MAX_LEN];
+} mesh_tx_entry_t;
+
+static mesh_tx_entry_t tx_entries[MESH_TX_QUEUE_LEN];
+static struct {
+    uint32_t next_seq;
+    uint8_t  queued;        // entries in TX_ENTRY_QUEUED
+    bool     paused;        // host was told to pause
+    bool     draining;      // one task hands entries to the stack at a time, keeps admission order
+    int64_t  tat;           // time (us) the bucket is full again
+    int64_t  interval_us;   // spacing per segment, grows while stack reports congestion
+} tx_admit = {
+    .interval_us = MESH_FANOUT_INTERVAL_MS * 1000,
+};
+static portMUX_TYPE tx_lock = portMUX_INITIALIZER_UNLOCKED; // sends from dispatch task, completions from the btc task
+static esp_timer_handle_t tx_timer = NULL;
+static void tx_admit_drain(void);
+static uint32_t mesh_message_segments(uint16_t length);
+static void tx_admit_send_comp(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode, int err_code);
+static void tx_admit_response(uint16_t dst_address, uint8_t status);
+
+#if MESH_EDGE_SEND_TTL < 2 || MESH_EDGE_SEND_TTL > MESH_TTL_MAX
+#error "MESH_EDGE_SEND_TTL must be a ttl edges can send with"
+#endif
+
+#if defined(CONFIG_BLE_MESH_ADV_BUF_COUNT) && MESH_TX_BURST_SEGMENTS > CONFIG_BLE_MESH_ADV_BUF_COUNT
+#error "MESH_TX_BURST_SEGMENTS must fit in the advertising buffer pool"
+#endif
+
+// one large transfer at a time, host streams it in and only MESH_XFER_WINDOW chunks are buffered,
+// chunk i lives in window[i % MESH_XFER_WINDOW] until the node acked it
+#define XFER_CHUNK_HEADER_LEN   6
+#define XFER_FLAG_ACK_REQ       0x01 // last chunk of a burst, node acks right away
+
+static struct {
+    bool     active;
+    uint8_t  transfer_id;
+    uint16_t dst_address;
+    uint32_t total_length;
+    uint16_t chunk_count;
+    uint32_t filled;        // bytes received from host
+    uint16_t base;          // oldest chunk not acked
+    uint16_t next_send;     // next chunk never sent
+    uint8_t  sack;          // chunks received beyond base, bit i is chunk base + 1 + i
+    uint8_t  retries;       // ack timeouts in a row
+    bool     kick;          // timer run sends new chunks instead of handling an ack timeout
+    bool     ack_queued;    // ack request chunk waits in the tx queue, its handoff starts the ack timeout
+    uint16_t ack_chunk;     // index of that chunk
+    uint8_t  window[MESH_XFER_WINDOW][MESH_XFER_CHUNK_LEN];
+    void (*status_handler)(uint16_t dst_address, uint8_t status, uint32_t offset);
+} xfer;
+static portMUX_TYPE xfer_lock = portMUX_INITIALIZER_UNLOCKED; // host writes from dispatch task, acks from the btc task
+static esp_timer_handle_t xfer_timer = NULL;
+static void xfer_recv_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr);
+static void xfer_send_outcome(uint16_t index, uint8_t status);
+
+// important messages waiting for their ack, sent without client response tracking (the stack allows one pending
+// request per node and opcode) and matched by (node, sequence) carried at the start of the payload
+#define IMPORTANT_SEQ_LEN       2
+
+typedef struct {
+    bool     active;
+    uint16_t dst_address;
+    uint16_t seq;
+    uint8_t  retransmits;
+    uint32_t timeout_ms;    // ack timeout of the first try, node response timeout when learned
+    int64_t  sent_at;       // esp_timer time (us) of the first try, rtt sample if acked before any retransmit
+    uint16_t length;        // including sequence
+    uint8_t *data;          // | 2 byte sequence | message |, block of pool_small or pool_large
+} important_message_t;
+
+static important_message_t important_messages[MESH_IMPORTANT_MAX_INFLIGHT];
+
+// ack timeouts on a timer wheel, entry i is important_messages[i], ticks only while a message waits for its ack
+static uint16_t important_wheel_slots[MESH_RETX_WHEEL_SLOTS];
+static mesh_wheel_entry_t important_wheel_entries[MESH_IMPORTANT_MAX_INFLIGHT];
+static mesh_wheel_t important_wheel;
+
+// important message buffers, no heap on the send path, a full pool refuses the send right away
+#define POOL_LARGE_BLOCK MESH_SLAB_BLOCK_SIZE(MESH_MSG_MAX_LEN)
+static uint8_t pool_small_memory[MESH_POOL_SMALL_COUNT][MESH_SLAB_BLOCK_SIZE(MESH_POOL_SMALL_BLOCK)] __attribute__((aligned(4)));
+static uint8_t pool_large_memory[MESH_POOL_LARGE_COUNT][POOL_LARGE_BLOCK] __attribute__((aligned(4)));
+static uint16_t pool_small_links[MESH_POOL_SMALL_COUNT];
+static uint16_t pool_large_links[MESH_POOL_LARGE_COUNT];
+static mesh_slab_t pool_small;
+static mesh_slab_t pool_large;
+static uint16_t important_next_seq = 0;
+static portMUX_TYPE important_lock = portMUX_INITIALIZER_UNLOCKED; // sends from callers, acks from the btc task
+static esp_timer_handle_t important_timer = NULL;
+static void important_recv_ack(uint16_t src_address, uint16_t seq);
+
+// important messages received lately, an edge retransmits when root's ack got lost, btc task only
+typedef struct {
+    uint16_t src_address;   // ESP_BLE_MESH_ADDR_UNASSIGNED marks a free entry
+    uint16_t seq;
+    int64_t  received_at;
+} important_seen_t;
+
+static important_seen_t important_seen[MESH_DEDUP_CACHE_SIZE];
+
+// important messages journaled in nvs, one key per important_messages entry, changes written in batches
+#define OUTBOX_DST_LEN          2 // record is | 2 byte node addr | 2 byte sequence | message |, sequence kept on replay
+#define OUTBOX_TASK_PRIORITY    1 // nvs writes and commits stay below everything else, flash erases can take tens of ms
+
+static bool outbox_dirty[MESH_IMPORTANT_MAX_INFLIGHT]; // under important_lock, entry changed since its last write
+static uint8_t outbox_record[OUTBOX_DST_LEN + MESH_MSG_MAX_LEN]; // under outbox_mutex
+static nvs_handle_t outbox_nvs;
+static bool outbox_open = false;
+static SemaphoreHandle_t outbox_mutex = NULL; // flush runs in the outbox task or for the OUTBX command
+static TaskHandle_t outbox_task_handle = NULL;
+
+// nodes[] entries are rebuilt and their composition data freed by the btc task while host queries walk them
+static SemaphoreHandle_t node_table_mutex = NULL;
+static esp_timer_handle_t outbox_timer = NULL;
+static void outbox_schedule(void);
+
+// acks of important messages waiting to go out together, one ECS_193_MODEL_OP_ACK_I per node and window
+#define ACK_I_BITMAP_BITS       16
+
+typedef struct {
+    bool     active;
+    esp_ble_mesh_msg_ctx_t ctx; // of the first message acked, the ack goes back the same way
+    uint16_t first_seq;
+    uint16_t bitmap;            // bit i acks first_seq + i
+    int64_t  deadline;          // esp_timer time (us) the ack is sent
+} ack_aggregate_t;
+
+static ack_aggregate_t ack_aggregates[MESH_ACK_AGGREGATE_NODES];
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED; // acks added from the btc task, sent from the timer task
+static esp_timer_handle_t ack_timer = NULL;
+
+// group membership, one entry per (group, node), applied on the edge with Config Model Subscription Add/Delete
+#define GROUP_SUB_ADD_PENDING   0
+#define GROUP_SUB_ADD_SENT      1
+#define GROUP_SUBSCRIBED        2
+#define GROUP_SUB_DEL_PENDING   3
+#define GROUP_SUB_DEL_SENT      4
+#define GROUP_SUB_ADD_SENT_DEL  5 // add in flight and host deleted meanwhile, delete follows the add status
+
+typedef struct {
+    uint16_t group_addr; // ESP_BLE_MESH_ADDR_UNASSIGNED marks a free entry
+    uint16_t node_addr;
+    uint8_t  state;
+    uint8_t  retries;    // timeouts of the change in flight
+} mesh_group_member_t;
+
+static mesh_group_member_t group_members[MESH_GROUP_MAX_MEMBERSHIPS] = {
+    [0 ... (MESH_GROUP_MAX_MEMBERSHIPS - 1)] = {
+        .group_addr = ESP_BLE_MESH_ADDR_UNASSIGNED,
+    }
+};
+static portMUX_TYPE group_lock = portMUX_INITIALIZER_UNLOCKED; // host commands from dispatch task, statuses from the btc task
+
 // static nvs_handle_t NVS_HANDLE;
 // static const char * NVS_KEY = NVS_KEY_ROOT;
 
@@ -97,6 +308,8 @@ static const esp_ble_mesh_client_op_pair_t client_op_pair[] = {
     {ECS_193_MODEL_OP_BROADCAST, ECS_193_MODEL_OP_EMPTY},
     {ECS_193_MODEL_OP_CONNECTIVITY, ECS_193_MODEL_OP_RESPONSE},
     {ECS_193_MODEL_OP_SET_TTL, ECS_193_MODEL_OP_EMPTY},
+    {ECS_193_MODEL_OP_CHUNK, ECS_193_MODEL_OP_EMPTY}, // acked per window with ECS_193_MODEL_OP_CHUNK_ACK, not per message
+    {ECS_193_MODEL_OP_MESSAGE_I, ECS_193_MODEL_OP_EMPTY}, // acked with ECS_193_MODEL_OP_RESPONSE_I, matched by sequence
 };
 
 static esp_ble_mesh_client_t ecs_193_client = {
@@ -121,6 +334,11 @@ static esp_ble_mesh_model_op_t server_op[] = { // operation server will "RECEIVE
     ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_BROADCAST, 1),
     ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_CONNECTIVITY, 1),
     ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_SET_TTL, 1), // Root send this, don't receive, put the commented line so is symmetric as edge
+    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_CHUNK, 6),   // Root send this, don't receive, symmetric as edge
+    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_CHUNK_ACK, 4),
+    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE_I, 2),
+    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_RESPONSE_I, 2),
+    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_ACK_I, 4),
     ESP_BLE_MESH_MODEL_OP_END,
 };
 
@@ -164,11 +382,53 @@ static void (*recv_response_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t le
 static void (*timeout_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode) = NULL;
 static void (*broadcast_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr) = NULL;
 static void (*connectivity_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr) = NULL;
+static void (*group_status_handler_cb)(uint16_t group_addr, uint16_t node_addr, uint8_t status) = NULL;
+static void (*tx_flow_handler_cb)(bool paused, uint8_t queued) = NULL;
 
 // ====================== ROOT Core Network Functions ======================
+void node_table_lock(void)
+{
+    if (node_table_mutex != NULL) {
+        xSemaphoreTake(node_table_mutex, portMAX_DELAY);
+    }
+}
+
+void node_table_unlock(void)
+{
+    if (node_table_mutex != NULL) {
+        xSemaphoreGive(node_table_mutex);
+    }
+}
+
+static void topology_touch(esp_ble_mesh_node_info_t *node)
+{
+    node->version = ++topology_version;
+}
+
+static void node_free_comp_data(esp_ble_mesh_node_info_t *node)
+{
+    for (int i = 0; i < node->elem_num; i++) {
+        if (node->sig_models) {
+            free(node->sig_models[i]);
+        }
+        if (node->vnd_models) {
+            free(node->vnd_models[i]);
+        }
+    }
+    free(node->sig_model_num);
+    free(node->vnd_model_num);
+    free(node->sig_models);
+    free(node->vnd_models);
+    node->sig_model_num = NULL;
+    node->vnd_model_num = NULL;
+    node->sig_models = NULL;
+    node->vnd_models = NULL;
+}
+
 static esp_err_t example_ble_mesh_store_node_info(const uint8_t uuid[16], uint16_t unicast, uint8_t elem_num)
 {
     int i;
+    esp_ble_mesh_node_info_t *slot = NULL;
 
     if (!uuid || !ESP_BLE_MESH_ADDR_IS_UNICAST(unicast)) {
         return ESP_ERR_INVALID_ARG;
@@ -176,24 +436,50 @@ static esp_err_t example_ble_mesh_store_node_info(const uint8_t uuid[16], uint16
 
     /* Judge if the device has been provisioned before */
     for (i = 0; i < ARRAY_SIZE(nodes); i++) {
-        if (!memcmp(nodes[i].uuid, uuid, 16)) {
+        if (nodes[i].unicast != ESP_BLE_MESH_ADDR_UNASSIGNED && !memcmp(nodes[i].uuid, uuid, 16)) {
             ESP_LOGW(TAG, "%s: reprovisioned device 0x%04x", __func__, unicast);
-            nodes[i].unicast = unicast;
-            nodes[i].elem_num = elem_num;
-            return ESP_OK;
+            slot = &nodes[i];
+            break;
         }
     }
 
-    for (i = 0; i < ARRAY_SIZE(nodes); i++) {
+    for (i = 0; i < ARRAY_SIZE(nodes) && slot == NULL; i++) {
         if (nodes[i].unicast == ESP_BLE_MESH_ADDR_UNASSIGNED) {
-            memcpy(nodes[i].uuid, uuid, 16);
-            nodes[i].unicast = unicast;
-            nodes[i].elem_num = elem_num;
-            return ESP_OK;
+            slot = &nodes[i];
+        }
+    }
+
+    // table full, reuse the oldest removed node, hosts behind its version lose the removal and get a full table
+    if (slot == NULL) {
+        for (i = 0; i < ARRAY_SIZE(nodes); i++) {
+            if (nodes[i].removed && (slot == NULL || nodes[i].version < slot->version)) {
+                slot = &nodes[i];
+            }
         }
     }
+    if (slot == NULL) {
+        return ESP_FAIL;
+    }
+    if (slot->removed && slot->version > topology_floor) {
+        topology_floor = slot->version;
+    }
 
-    return ESP_FAIL;
+    node_free_comp_data(slot);
+    memcpy(slot->uuid, uuid, 16);
+    slot->unicast = unicast;
+    slot->elem_num = elem_num;
+    slot->configured = false;
+    slot->removed = false;
+    slot->last_seen = 0;
+    slot->hops = MESH_HOPS_UNKNOWN;
+    slot->ttl_override = MESH_TTL_AUTO;
+    slot->srtt_us = 0;
+    slot->rttvar_us = 0;
+    slot->rto_backoff = 0;
+    slot->rtt_sent = 0;
+    slot->rsp_opcode = 0;
+    topology_touch(slot);
+    return ESP_OK;
 }
 
 static esp_ble_mesh_node_info_t *example_ble_mesh_get_node_info(uint16_t unicast)
@@ -205,7 +491,7 @@ static esp_ble_mesh_node_info_t *example_ble_mesh_get_node_info(uint16_t unicast
     }
 
     for (i = 0; i < ARRAY_SIZE(nodes); i++) {
-        if (nodes[i].unicast <= unicast &&
+        if (!nodes[i].removed && nodes[i].unicast <= unicast &&
                 nodes[i].unicast + nodes[i].elem_num > unicast) {
             return &nodes[i];
         }
@@ -214,6 +500,129 @@ static esp_ble_mesh_node_info_t *example_ble_mesh_get_node_info(uint16_t unicast
     return NULL;
 }
 
+// link quality of the last message heard from a node, reported in node queries
+static void node_mark_seen(const esp_ble_mesh_msg_ctx_t *ctx)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(ctx->addr);
+    if (node == NULL) {
+        return;
+    }
+
+    node->last_seen = esp_timer_get_time();
+    node->last_rssi = ctx->recv_rssi;
+    node->last_ttl = ctx->recv_ttl;
+
+    // relays on the path, a longer path is taken right away, a shorter one a hop per message so one lucky
+    // packet doesn't starve the node of ttl
+    if (ctx->recv_ttl <= MESH_EDGE_SEND_TTL) {
+        uint8_t relays = MESH_EDGE_SEND_TTL - ctx->recv_ttl;
+        if (node->hops == MESH_HOPS_UNKNOWN || relays >= node->hops) {
+            node->hops = relays;
+        } else {
+            node->hops--;
+        }
+    }
+}
+
+// response missing, the path may have grown, give the next send one more hop until a message shows the real count
+static void node_ttl_miss(uint16_t unicast)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node != NULL && node->hops != MESH_HOPS_UNKNOWN && node->hops + 2 + MESH_TTL_MARGIN <= MESH_TTL_MAX) {
+        node->hops++;
+    }
+}
+
+uint8_t get_node_ttl(uint16_t unicast)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL || (node->ttl_override == MESH_TTL_AUTO && node->hops == MESH_HOPS_UNKNOWN)) {
+        return ble_message_ttl;
+    }
+    if (node->ttl_override != MESH_TTL_AUTO) {
+        return node->ttl_override;
+    }
+
+    // a message with ttl 2 or more is relayed once per hop, ttl 0 is never relayed
+    uint16_t ttl = node->hops + 1 + MESH_TTL_MARGIN;
+    return (ttl < MESH_TTL_MAX ? ttl : MESH_TTL_MAX);
+}
+
+// response time sample, only from requests answered on the first try (Karn) so a late response to an earlier try
+// never counts, rtt variation updated before the smoothed rtt as in RFC 6298
+static void node_rtt_sample(uint16_t unicast, uint32_t rtt_us)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL) {
+        return;
+    }
+
+    if (node->srtt_us == 0) {
+        node->srtt_us = (rtt_us > 0 ? rtt_us : 1);
+        node->rttvar_us = rtt_us / 2;
+    } else {
+        uint32_t delta = (rtt_us > node->srtt_us ? rtt_us - node->srtt_us : node->srtt_us - rtt_us);
+        node->rttvar_us = node->rttvar_us - node->rttvar_us / 4 + delta / 4;
+        node->srtt_us = node->srtt_us - node->srtt_us / 8 + rtt_us / 8;
+    }
+    node->rto_backoff = 0;
+}
+
+// response opcode the client model pairs with a request, ECS_193_MODEL_OP_EMPTY if it takes none
+static uint32_t client_response_opcode(uint32_t opcode)
+{
+    for (int i = 0; i < ARRAY_SIZE(client_op_pair); i++) {
+        if (client_op_pair[i].cli_op == opcode) {
+            return client_op_pair[i].status_op;
+        }
+    }
+    return ECS_193_MODEL_OP_EMPTY;
+}
+
+// response to the pending MESSAGE_R, the stack allows one request per node so the send time is kept on the node,
+// a response that doesn't answer that request is no sample
+static void node_rtt_response(uint16_t unicast, uint32_t opcode)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL || node->rtt_sent == 0 || node->rsp_opcode != ECS_193_MODEL_OP_MESSAGE_R ||
+        client_response_opcode(node->rsp_opcode) != opcode) {
+        return;
+    }
+    int64_t rtt_us = esp_timer_get_time() - node->rtt_sent;
+    node->rtt_sent = 0;
+    node_rtt_sample(unicast, (uint32_t) rtt_us);
+}
+
+// no response in time, the next request waits twice as long until a response gives a new sample
+static void node_rtt_timeout(uint16_t unicast, uint32_t opcode)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL) {
+        return;
+    }
+    if (opcode == ECS_193_MODEL_OP_MESSAGE_R) {
+        node->rtt_sent = 0;
+    }
+    if (node->srtt_us != 0 && node->rto_backoff < MESH_RTO_MAX_BACKOFF) {
+        node->rto_backoff++;
+    }
+}
+
+uint32_t get_node_timeout(uint16_t unicast)
+{
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL || node->srtt_us == 0) {
+        return MSG_TIMEOUT;
+    }
+
+    uint32_t timeout_ms = (node->srtt_us + 4 * node->rttvar_us + 999) / 1000;
+    if (timeout_ms < MESH_RTO_MIN_MS) {
+        timeout_ms = MESH_RTO_MIN_MS;
+    }
+    timeout_ms <<= node->rto_backoff;
+    return (timeout_ms < MESH_RTO_MAX_MS ? timeout_ms : MESH_RTO_MAX_MS);
+}
+
 static esp_err_t ble_mesh_set_msg_common(esp_ble_mesh_client_common_param_t *common,uint16_t unicast, esp_ble_mesh_model_t *model, uint32_t opcode)
 {
     common->opcode = opcode;
@@ -221,8 +630,8 @@ static esp_err_t ble_mesh_set_msg_common(esp_ble_mesh_client_common_param_t *com
     common->ctx.net_idx = ble_mesh_key.net_idx;
     common->ctx.app_idx = ble_mesh_key.app_idx;
     common->ctx.addr = unicast;
-    common->ctx.send_ttl = ble_message_ttl;
-    common->msg_timeout = MSG_TIMEOUT;
+    common->ctx.send_ttl = get_node_ttl(unicast);
+    common->msg_timeout = get_node_timeout(unicast);
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 2, 0)
     common->msg_role = MSG_ROLE_ROOT;
 #endif
@@ -377,7 +786,9 @@ static esp_err_t prov_complete(uint16_t node_index, const esp_ble_mesh_octet16_t
         return ESP_FAIL;
     }
 
+    node_table_lock();
     err = example_ble_mesh_store_node_info(uuid, primary_addr, element_num);
+    node_table_unlock();
     if (err) {
         ESP_LOGE(TAG, "%s: Store node info failed", __func__);
         return ESP_FAIL;
@@ -509,6 +920,24 @@ static void ble_mesh_provisioning_cb(esp_ble_mesh_prov_cb_event_t event, esp_ble
     case ESP_BLE_MESH_PROVISIONER_STORE_NODE_COMP_DATA_COMP_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_PROVISIONER_STORE_NODE_COMP_DATA_COMP_EVT, err_code %d", param->provisioner_store_node_comp_data_comp.err_code);
         break;
+    case ESP_BLE_MESH_PROVISIONER_DELETE_NODE_WITH_UUID_COMP_EVT:
+        ESP_LOGI(TAG, "ESP_BLE_MESH_PROVISIONER_DELETE_NODE_WITH_UUID_COMP_EVT, err_code %d", param->provisioner_delete_node_with_uuid_comp.err_code);
+        if (param->provisioner_delete_node_with_uuid_comp.err_code == 0) {
+            esp_ble_mesh_node_info_t *node = topology_find_uuid(param->provisioner_delete_node_with_uuid_comp.uuid);
+            if (node) {
+                topology_remove_node(node);
+            }
+        }
+        break;
+    case ESP_BLE_MESH_PROVISIONER_DELETE_NODE_WITH_ADDR_COMP_EVT:
+        ESP_LOGI(TAG, "ESP_BLE_MESH_PROVISIONER_DELETE_NODE_WITH_ADDR_COMP_EVT, err_code %d", param->provisioner_delete_node_with_addr_comp.err_code);
+        if (param->provisioner_delete_node_with_addr_comp.err_code == 0) {
+            esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(param->provisioner_delete_node_with_addr_comp.unicast_addr);
+            if (node) {
+                topology_remove_node(node);
+            }
+        }
+        break;
     default:
         break;
     }
@@ -848,6 +1277,265 @@ static esp_err_t config_complete(esp_ble_mesh_msg_ctx_t ctx) {
     return ESP_OK;
 }
 
+// ====================== Group Subscription Functions ======================
+// table helpers below expect group_lock held, config client calls are made on a copy after releasing it
+static mesh_group_member_t *group_find_member(uint16_t group_addr, uint16_t node_addr)
+{
+    for (int i = 0; i < ARRAY_SIZE(group_members); i++) {
+        if (group_members[i].group_addr == group_addr && group_members[i].node_addr == node_addr) {
+            return &group_members[i];
+        }
+    }
+    return NULL;
+}
+
+// entry of the node waiting for a Model Subscription Status
+static mesh_group_member_t *group_find_sent(uint16_t node_addr)
+{
+    for (int i = 0; i < ARRAY_SIZE(group_members); i++) {
+        if (group_members[i].group_addr != ESP_BLE_MESH_ADDR_UNASSIGNED && group_members[i].node_addr == node_addr &&
+            (group_members[i].state == GROUP_SUB_ADD_SENT || group_members[i].state == GROUP_SUB_DEL_SENT ||
+             group_members[i].state == GROUP_SUB_ADD_SENT_DEL)) {
+            return &group_members[i];
+        }
+    }
+    return NULL;
+}
+
+static void group_free_member(mesh_group_member_t *member)
+{
+    member->group_addr = ESP_BLE_MESH_ADDR_UNASSIGNED;
+    member->node_addr = ESP_BLE_MESH_ADDR_UNASSIGNED;
+}
+
+// change in flight never reached the node, back to pending, an add deleted meanwhile is simply dropped
+static void group_unsend(mesh_group_member_t *member)
+{
+    if (member->state == GROUP_SUB_ADD_SENT) {
+        member->state = GROUP_SUB_ADD_PENDING;
+    } else if (member->state == GROUP_SUB_DEL_SENT) {
+        member->state = GROUP_SUB_DEL_PENDING;
+    } else if (member->state == GROUP_SUB_ADD_SENT_DEL) {
+        group_free_member(member);
+    }
+}
+
+static esp_err_t group_send_sub(const mesh_group_member_t *member)
+{
+    esp_ble_mesh_client_common_param_t common = {0};
+    esp_ble_mesh_cfg_client_set_state_t set = {0};
+
+    bool add = (member->state == GROUP_SUB_ADD_SENT || member->state == GROUP_SUB_ADD_SENT_DEL);
+    if (add) {
+        ble_mesh_set_msg_common(&common, member->node_addr, config_client.model, ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD);
+        set.model_sub_add.element_addr = member->node_addr;
+        set.model_sub_add.sub_addr = member->group_addr;
+        set.model_sub_add.model_id = ECS_193_MODEL_ID_SERVER;
+        set.model_sub_add.company_id = ECS_193_CID;
+    } else {
+        ble_mesh_set_msg_common(&common, member->node_addr, config_client.model, ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE);
+        set.model_sub_delete.element_addr = member->node_addr;
+        set.model_sub_delete.sub_addr = member->group_addr;
+        set.model_sub_delete.model_id = ECS_193_MODEL_ID_SERVER;
+        set.model_sub_delete.company_id = ECS_193_CID;
+    }
+
+    esp_err_t err = esp_ble_mesh_config_client_set_state(&common, &set);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send Config Model Subscription %s to node 0x%04x, err_code %d",
+            add ? "Add" : "Delete", member->node_addr, err);
+    }
+    return err;
+}
+
+// send of a copied entry failed, the entry may have changed or gone meanwhile so find it again
+static void group_send_failed(const mesh_group_member_t *sent)
+{
+    portENTER_CRITICAL(&group_lock);
+    mesh_group_member_t *member = group_find_member(sent->group_addr, sent->node_addr);
+    if (member != NULL) {
+        group_unsend(member);
+    }
+    portEXIT_CRITICAL(&group_lock);
+}
+
+// send the next pending subscription change of a node, one at a time since config client allows one outstanding message per node
+// return true if a change is on the way
+static bool group_sync_next(uint16_t node_addr)
+{
+    mesh_group_member_t sent = {0};
+    bool claimed = false;
+
+    portENTER_CRITICAL(&group_lock);
+    if (group_find_sent(node_addr) != NULL) {
+        portEXIT_CRITICAL(&group_lock);
+        return true;
+    }
+
+    // moving the entry to SENT under the lock claims it, the other task sees the change in flight and backs off
+    for (int i = 0; i < ARRAY_SIZE(group_members) && !claimed; i++) {
+        mesh_group_member_t *member = &group_members[i];
+        if (member->group_addr == ESP_BLE_MESH_ADDR_UNASSIGNED || member->node_addr != node_addr) {
+            continue;
+        }
+
+        if (member->state == GROUP_SUB_ADD_PENDING) {
+            member->state = GROUP_SUB_ADD_SENT;
+        } else if (member->state == GROUP_SUB_DEL_PENDING) {
+            member->state = GROUP_SUB_DEL_SENT;
+        } else {
+            continue;
+        }
+
+        member->retries = 0;
+        sent = *member;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&group_lock);
+
+    if (!claimed) {
+        return false;
+    }
+    if (group_send_sub(&sent) == ESP_OK) {
+        return true;
+    }
+    // left pending, retried on the next group command or subscription status of this node
+    group_send_failed(&sent);
+    return false;
+}
+
+// a (re)provisioned node starts without subscriptions, queue every membership again
+static void group_reset_node(uint16_t node_addr)
+{
+    portENTER_CRITICAL(&group_lock);
+    for (int i = 0; i < ARRAY_SIZE(group_members); i++) {
+        mesh_group_member_t *member = &group_members[i];
+        if (member->group_addr == ESP_BLE_MESH_ADDR_UNASSIGNED || member->node_addr != node_addr) {
+            continue;
+        }
+
+        if (member->state == GROUP_SUB_DEL_PENDING || member->state == GROUP_SUB_DEL_SENT || member->state == GROUP_SUB_ADD_SENT_DEL) {
+            group_free_member(member);
+        } else {
+            member->state = GROUP_SUB_ADD_PENDING;
+        }
+    }
+    portEXIT_CRITICAL(&group_lock);
+}
+
+static void group_recv_sub_status(uint16_t node_addr, uint8_t status)
+{
+    portENTER_CRITICAL(&group_lock);
+    mesh_group_member_t *member = group_find_sent(node_addr);
+    if (member == NULL) {
+        portEXIT_CRITICAL(&group_lock);
+        ESP_LOGW(TAG, "Unexpected Model Subscription Status from node 0x%04x", node_addr);
+        return;
+    }
+
+    uint16_t group_addr = member->group_addr;
+    uint8_t result = MESH_GROUP_SUBSCRIBED;
+    bool leave = false;
+    if (status != 0x00) {
+        result = MESH_GROUP_FAILED;
+        group_free_member(member);
+    } else if (member->state == GROUP_SUB_ADD_SENT) {
+        member->state = GROUP_SUBSCRIBED;
+    } else if (member->state == GROUP_SUB_ADD_SENT_DEL) {
+        // joined, now leave as host asked while the add was in flight
+        member->state = GROUP_SUB_DEL_PENDING;
+        leave = true;
+    } else {
+        result = MESH_GROUP_UNSUBSCRIBED;
+        group_free_member(member);
+    }
+    portEXIT_CRITICAL(&group_lock);
+
+    if (status != 0x00) {
+        ESP_LOGE(TAG, "Node 0x%04x rejected subscription change on group 0x%04x, status 0x%02x", node_addr, group_addr, status);
+    }
+    group_status_handler_cb(group_addr, node_addr, result);
+    if (leave) {
+        group_sync_next(node_addr);
+    }
+}
+
+// finish configuration once the node applied all its group subscriptions
+static void group_sync_or_complete(esp_ble_mesh_node_info_t *node, esp_ble_mesh_msg_ctx_t ctx)
+{
+    if (group_sync_next(node->unicast) || node->configured) {
+        return;
+    }
+
+    node_table_lock();
+    node->configured = true;
+    topology_touch(node);
+    node_table_unlock();
+    ESP_LOGW(TAG, "Node 0x%04x, Provision and config successfully", node->unicast);
+    config_complete(ctx);
+}
+
+// ====================== Topology Functions ======================
+// node deleted from the provisioner, kept as removed so delta reports carry the removal
+static void topology_remove_node(esp_ble_mesh_node_info_t *node)
+{
+    portENTER_CRITICAL(&group_lock);
+    for (int i = 0; i < ARRAY_SIZE(group_members); i++) {
+        if (group_members[i].group_addr != ESP_BLE_MESH_ADDR_UNASSIGNED && group_members[i].node_addr == node->unicast) {
+            group_free_member(&group_members[i]);
+        }
+    }
+    portEXIT_CRITICAL(&group_lock);
+
+    ESP_LOGW(TAG, "Node 0x%04x removed from network", node->unicast);
+    node_table_lock();
+    node_free_comp_data(node);
+    node->configured = false;
+    node->removed = true;
+    topology_touch(node);
+    node_table_unlock();
+}
+
+static esp_ble_mesh_node_info_t *topology_find_uuid(const uint8_t uuid[16])
+{
+    for (int i = 0; i < ARRAY_SIZE(nodes); i++) {
+        if (nodes[i].unicast != ESP_BLE_MESH_ADDR_UNASSIGNED && !nodes[i].removed && !memcmp(nodes[i].uuid, uuid, 16)) {
+            return &nodes[i];
+        }
+    }
+    return NULL;
+}
+
+// nodes[] only lives in ram, rebuild it from the provisioner node table (restored from persistent memory) at boot
+static void topology_restore(void)
+{
+    const esp_ble_mesh_node_t **node_table = esp_ble_mesh_provisioner_get_node_table_entry();
+
+    topology_epoch = esp_random();
+    for (int i = 0; i < CONFIG_BLE_MESH_MAX_PROV_NODES; i++) {
+        const esp_ble_mesh_node_t *entry = node_table[i];
+        if (entry == NULL) {
+            continue;
+        }
+
+        node_table_lock();
+        if (example_ble_mesh_store_node_info(entry->dev_uuid, entry->unicast_addr, entry->element_num) != ESP_OK) {
+            node_table_unlock();
+            ESP_LOGE(TAG, "Failed to restore node 0x%04x", entry->unicast_addr);
+            continue;
+        }
+
+        // composition data is only stored at the end of a successful config chain
+        esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(entry->unicast_addr);
+        if (entry->comp_data != NULL && entry->comp_length > 0) {
+            example_ble_mesh_parse_node_comp_data(node, entry->comp_data, entry->comp_length);
+            node->configured = true;
+        }
+        node_table_unlock();
+    }
+    ESP_LOGI(TAG, "Restored %d nodes, topology version %" PRIu32, esp_ble_mesh_provisioner_get_prov_node_count(), topology_version);
+}
+
 static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t event, esp_ble_mesh_cfg_client_cb_param_t *param)
 {
     esp_ble_mesh_client_common_param_t common = {0};
@@ -860,6 +1548,14 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
 
     if (param->error_code) {
         ESP_LOGE(TAG, "Send config client message failed, opcode 0x%04" PRIx32, param->params->opcode);
+        if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD || param->params->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE) {
+            portENTER_CRITICAL(&group_lock);
+            mesh_group_member_t *member = group_find_sent(param->params->ctx.addr);
+            if (member != NULL) {
+                group_unsend(member);
+            }
+            portEXIT_CRITICAL(&group_lock);
+        }
         return;
     }
 
@@ -874,8 +1570,10 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
         if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_COMPOSITION_DATA_GET) {
             ESP_LOGI(TAG, "composition data %s", bt_hex(param->status_cb.comp_data_status.composition_data->data,
                     param->status_cb.comp_data_status.composition_data->len));
+            node_table_lock();
             example_ble_mesh_parse_node_comp_data(node, param->status_cb.comp_data_status.composition_data->data,
                                                         param->status_cb.comp_data_status.composition_data->len);
+            node_table_unlock();
 
             err = esp_ble_mesh_provisioner_store_node_comp_data(param->params->ctx.addr,
                 param->status_cb.comp_data_status.composition_data->data,
@@ -909,8 +1607,11 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
         } else if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_APP_BIND) {
             ESP_LOGI(TAG, "The Remote Provisioning Server have been provisioned, You could click button to start remote provisioning");
             remote_rpr_srv_addr = param->params->ctx.addr;
-            ESP_LOGW(TAG, "%s, Provision and config successfully", __func__);
-            config_complete(param->params->ctx);
+            group_reset_node(node->unicast);
+            group_sync_or_complete(node, param->params->ctx);
+        } else if (param->params->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD || param->params->opcode == ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE) {
+            group_recv_sub_status(param->params->ctx.addr, param->status_cb.model_sub_status.status);
+            group_sync_or_complete(node, param->params->ctx);
         }
         break;
     case ESP_BLE_MESH_CFG_CLIENT_PUBLISH_EVT:
@@ -952,6 +1653,34 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
                 ESP_LOGE(TAG, "Failed to send Config Model App Bind");
             }
             break;
+        case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_ADD:
+        case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE: {
+            mesh_group_member_t sent = {0};
+            bool give_up = false;
+            portENTER_CRITICAL(&group_lock);
+            mesh_group_member_t *member = group_find_sent(param->params->ctx.addr);
+            if (member != NULL) {
+                sent = *member;
+                // node unreachable, give the change up so its other changes and the host can move on
+                give_up = (++member->retries > MESH_GROUP_MAX_RETRIES);
+                if (give_up) {
+                    group_free_member(member);
+                }
+            }
+            portEXIT_CRITICAL(&group_lock);
+
+            if (member == NULL) {
+                break;
+            }
+            if (give_up) {
+                ESP_LOGE(TAG, "Node 0x%04x never answered subscription change on group 0x%04x", sent.node_addr, sent.group_addr);
+                group_status_handler_cb(sent.group_addr, param->params->ctx.addr, MESH_GROUP_FAILED);
+                group_sync_next(param->params->ctx.addr);
+            } else if (group_send_sub(&sent) != ESP_OK) {
+                group_send_failed(&sent);
+            }
+            break;
+        }
         default:
             break;
         }
@@ -962,54 +1691,231 @@ static void example_ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t
     }
 }
 
-// Custom Model callback logic
-static void ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event, esp_ble_mesh_model_cb_param_t *param)
+// remember (node, sequence) of a received important message, true if it was received within MESH_DEDUP_EXPIRY_MS
+// a new one replaces the oldest entry, free entries (address 0) count as oldest
+static bool important_seen_before(uint16_t src_address, uint16_t seq)
 {
-    // static int64_t start_time;
+    int64_t now = esp_timer_get_time();
+    important_seen_t *oldest = &important_seen[0];
+    int64_t oldest_age = -1;
 
-    switch (event) {
-    case ESP_BLE_MESH_MODEL_OPERATION_EVT:
-        switch (param->model_operation.opcode) {
-            case ECS_193_MODEL_OP_MESSAGE:
-            case ECS_193_MODEL_OP_MESSAGE_R:
-            case ECS_193_MODEL_OP_MESSAGE_I_0:
-            case ECS_193_MODEL_OP_MESSAGE_I_1:
-            case ECS_193_MODEL_OP_MESSAGE_I_2:
-                recv_message_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
-                break;
+    for (int i = 0; i < ARRAY_SIZE(important_seen); i++) {
+        important_seen_t *entry = &important_seen[i];
+        int64_t age = (entry->src_address == ESP_BLE_MESH_ADDR_UNASSIGNED ? INT64_MAX : now - entry->received_at);
 
-            case ECS_193_MODEL_OP_RESPONSE:
-            case ECS_193_MODEL_OP_RESPONSE_I_0:
-            case ECS_193_MODEL_OP_RESPONSE_I_1:
-            case ECS_193_MODEL_OP_RESPONSE_I_2:
-                recv_response_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
-                break;
-            
-            default:
-                break;
-        }
-        
-        if (param->model_operation.opcode == ECS_193_MODEL_OP_BROADCAST) {
-            broadcast_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
-        } else if (param->model_operation.opcode == ECS_193_MODEL_OP_CONNECTIVITY) {
-            connectivity_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
+        if (age <= MESH_DEDUP_EXPIRY_MS * 1000LL && entry->src_address == src_address && entry->seq == seq) {
+            ESP_LOGI(TAG, "Duplicate important message %d from 0x%04x, acked again", seq, src_address);
+            return true;
         }
-        
-        break;
-    case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
-        if (param->model_send_comp.err_code) {
-            ESP_LOGE(TAG, "Failed to send message 0x%06" PRIx32, param->model_send_comp.opcode);
-            break;
+        if (age > oldest_age) {
+            oldest = entry;
+            oldest_age = age;
         }
-        // start_time = esp_timer_get_time();
-        ESP_LOGI(TAG, "Send opcode [0x%06" PRIx32 "] completed", param->model_send_comp.opcode);
-        break;
-    case ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT:
+    }
 
-        ESP_LOGI(TAG, "Receive publish message 0x%06" PRIx32, param->client_recv_publish_msg.opcode);
-        break;
-    case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
+    oldest->src_address = src_address;
+    oldest->seq = seq;
+    oldest->received_at = now;
+    return false;
+}
+
+static void ack_aggregate_send(const ack_aggregate_t *ack)
+{
+    esp_ble_mesh_msg_ctx_t ctx = ack->ctx;
+    uint8_t data[4] = { ack->first_seq & 0xFF, ack->first_seq >> 8, ack->bitmap & 0xFF, ack->bitmap >> 8 };
+
+    esp_err_t err = esp_ble_mesh_server_model_send_msg(server_model, &ctx, ECS_193_MODEL_OP_ACK_I, sizeof(data), data);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send aggregated ack to node addr 0x%04x, err_code %d", ctx.addr, err);
+    }
+}
+
+static void ack_arm_timer(void)
+{
+    int64_t next_deadline = INT64_MAX;
+
+    portENTER_CRITICAL(&ack_lock);
+    for (int i = 0; i < ARRAY_SIZE(ack_aggregates); i++) {
+        if (ack_aggregates[i].active && ack_aggregates[i].deadline < next_deadline) {
+            next_deadline = ack_aggregates[i].deadline;
+        }
+    }
+    portEXIT_CRITICAL(&ack_lock);
+
+    if (next_deadline != INT64_MAX) {
+        int64_t delay_us = next_deadline - esp_timer_get_time();
+        esp_timer_stop(ack_timer);
+        esp_timer_start_once(ack_timer, delay_us > 0 ? delay_us : 0);
+    }
+}
+
+// window over, one ack per node carrying every sequence received meanwhile
+static void ack_timer_cb(void* arg)
+{
+    while (1) {
+        ack_aggregate_t due = {0};
+        int64_t now = esp_timer_get_time();
+
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < ARRAY_SIZE(ack_aggregates); i++) {
+            if (ack_aggregates[i].active && ack_aggregates[i].deadline <= now) {
+                due = ack_aggregates[i];
+                ack_aggregates[i].active = false;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&ack_lock);
+
+        if (!due.active) {
+            break;
+        }
+        ack_aggregate_send(&due);
+    }
+
+    ack_arm_timer();
+}
+
+// ack an important message, right away with RESPONSE_I when aggregation is off or no entry is free, otherwise
+// added to the node's pending ack, a sequence outside its bitmap sends the pending one first
+static void ack_aggregate_add(esp_ble_mesh_msg_ctx_t *ctx, uint16_t seq)
+{
+    ack_aggregate_t flushed = {0};
+    ack_aggregate_t *entry = NULL;
+    bool started = false;
+
+    if (MESH_ACK_AGGREGATE_MS > 0) {
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < ARRAY_SIZE(ack_aggregates); i++) {
+            if (ack_aggregates[i].active && ack_aggregates[i].ctx.addr == ctx->addr) {
+                entry = &ack_aggregates[i];
+                break;
+            }
+            if (!ack_aggregates[i].active && entry == NULL) {
+                entry = &ack_aggregates[i];
+            }
+        }
+        if (entry != NULL && entry->active && (uint16_t) (seq - entry->first_seq) >= ACK_I_BITMAP_BITS) {
+            flushed = *entry;
+            entry->active = false;
+        }
+        if (entry != NULL && !entry->active) {
+            entry->active = true;
+            entry->ctx = *ctx;
+            entry->first_seq = seq;
+            entry->bitmap = 0;
+            entry->deadline = esp_timer_get_time() + MESH_ACK_AGGREGATE_MS * 1000;
+            started = true;
+        }
+        if (entry != NULL) {
+            entry->bitmap |= 1 << (uint16_t) (seq - entry->first_seq);
+        }
+        portEXIT_CRITICAL(&ack_lock);
+    }
+
+    if (flushed.active) {
+        ack_aggregate_send(&flushed);
+    }
+    if (entry == NULL) {
+        uint8_t data[IMPORTANT_SEQ_LEN] = { seq & 0xFF, seq >> 8 };
+        send_response(ctx, IMPORTANT_SEQ_LEN, data, ECS_193_MODEL_OP_MESSAGE_I);
+        return;
+    }
+    if (started && !esp_timer_is_active(ack_timer)) {
+        ack_arm_timer();
+    }
+}
+
+// Custom Model callback logic
+static void ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event, esp_ble_mesh_model_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_BLE_MESH_MODEL_OPERATION_EVT:
+        node_mark_seen(param->model_operation.ctx);
+        if (param->model_operation.opcode == ECS_193_MODEL_OP_RESPONSE) {
+            node_rtt_response(param->model_operation.ctx->addr, param->model_operation.opcode);
+            tx_admit_response(param->model_operation.ctx->addr, MESH_SEND_DELIVERED);
+        }
+        switch (param->model_operation.opcode) {
+            case ECS_193_MODEL_OP_MESSAGE:
+            case ECS_193_MODEL_OP_MESSAGE_R:
+            case ECS_193_MODEL_OP_MESSAGE_I_0:
+            case ECS_193_MODEL_OP_MESSAGE_I_1:
+            case ECS_193_MODEL_OP_MESSAGE_I_2:
+                recv_message_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
+                break;
+
+            case ECS_193_MODEL_OP_RESPONSE:
+            case ECS_193_MODEL_OP_RESPONSE_I_0:
+            case ECS_193_MODEL_OP_RESPONSE_I_1:
+            case ECS_193_MODEL_OP_RESPONSE_I_2:
+                recv_response_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
+                break;
+
+            case ECS_193_MODEL_OP_MESSAGE_I: {
+                // acked here with the sequence, application gets the message without it and only once
+                uint8_t *msg_ptr = param->model_operation.msg;
+                ack_aggregate_add(param->model_operation.ctx, msg_ptr[0] | (msg_ptr[1] << 8));
+                if (important_seen_before(param->model_operation.ctx->addr, msg_ptr[0] | (msg_ptr[1] << 8))) {
+                    break;
+                }
+                recv_message_handler_cb(param->model_operation.ctx, param->model_operation.length - IMPORTANT_SEQ_LEN, msg_ptr + IMPORTANT_SEQ_LEN, param->model_operation.opcode);
+                break;
+            }
+
+            case ECS_193_MODEL_OP_RESPONSE_I: {
+                uint8_t *msg_ptr = param->model_operation.msg;
+                important_recv_ack(param->model_operation.ctx->addr, msg_ptr[0] | (msg_ptr[1] << 8));
+                recv_response_handler_cb(param->model_operation.ctx, param->model_operation.length - IMPORTANT_SEQ_LEN, msg_ptr + IMPORTANT_SEQ_LEN, param->model_operation.opcode);
+                break;
+            }
+
+            case ECS_193_MODEL_OP_ACK_I: {
+                // aggregated acks carry no response, nothing for the application
+                uint8_t *msg_ptr = param->model_operation.msg;
+                uint16_t first_seq = msg_ptr[0] | (msg_ptr[1] << 8);
+                uint16_t bitmap = msg_ptr[2] | (msg_ptr[3] << 8);
+                for (int i = 0; i < ACK_I_BITMAP_BITS; i++) {
+                    if (bitmap & (1 << i)) {
+                        important_recv_ack(param->model_operation.ctx->addr, first_seq + i);
+                    }
+                }
+                break;
+            }
+            
+            default:
+                break;
+        }
+        
+        if (param->model_operation.opcode == ECS_193_MODEL_OP_BROADCAST) {
+            broadcast_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
+        } else if (param->model_operation.opcode == ECS_193_MODEL_OP_CONNECTIVITY) {
+            connectivity_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
+        } else if (param->model_operation.opcode == ECS_193_MODEL_OP_CHUNK_ACK) {
+            xfer_recv_ack(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
+        }
+        
+        break;
+    case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
+        tx_admit_send_comp(param->model_send_comp.ctx, param->model_send_comp.opcode, param->model_send_comp.err_code);
+        if (param->model_send_comp.err_code == -EBUSY) {
+            ESP_LOGW(TAG, "Message 0x%06" PRIx32 " held, node has a request pending", param->model_send_comp.opcode);
+            break;
+        }
+        if (param->model_send_comp.err_code) {
+            ESP_LOGE(TAG, "Failed to send message 0x%06" PRIx32, param->model_send_comp.opcode);
+            break;
+        }
+        ESP_LOGI(TAG, "Send opcode [0x%06" PRIx32 "] completed", param->model_send_comp.opcode);
+        break;
+    case ESP_BLE_MESH_CLIENT_MODEL_RECV_PUBLISH_MSG_EVT:
+
+        ESP_LOGI(TAG, "Receive publish message 0x%06" PRIx32, param->client_recv_publish_msg.opcode);
+        break;
+    case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
         ESP_LOGW(TAG, "Client message 0x%06" PRIx32 " timeout", param->client_send_timeout.opcode);
+        tx_admit_response(param->client_send_timeout.ctx->addr, MESH_SEND_TIMEOUT);
+        node_ttl_miss(param->client_send_timeout.ctx->addr);
+        node_rtt_timeout(param->client_send_timeout.ctx->addr, param->client_send_timeout.opcode);
         timeout_handler_cb(param->client_send_timeout.ctx, param->client_send_timeout. opcode);
         break;
     default:
@@ -1018,186 +1924,1494 @@ static void ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event, esp_bl
     }
 }
 
-// ===================== Root Network Utility Functions (APIs) =====================
-void set_message_ttl(uint8_t new_ttl) {
-    ble_message_ttl = new_ttl;
+// ===================== Root Network Utility Functions (APIs) =====================
+void set_message_ttl(uint8_t new_ttl) {
+    ble_message_ttl = new_ttl;
+}
+
+esp_err_t set_node_ttl(uint16_t unicast, uint8_t ttl) {
+    // ttl 1 is a prohibited value for sending in the mesh profile
+    if ((ttl > MESH_TTL_MAX && ttl != MESH_TTL_AUTO) || ttl == 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(unicast);
+    if (node == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    node->ttl_override = ttl;
+    return ESP_OK;
+}
+
+uint32_t get_topology_version(uint32_t *epoch, uint32_t *floor) {
+    *epoch = topology_epoch;
+    *floor = topology_floor;
+    return topology_version;
+}
+
+const esp_ble_mesh_node_info_t *get_node_info_table(uint16_t *size) {
+    *size = ARRAY_SIZE(nodes);
+    return nodes;
+}
+
+// send one vendor message to a node in network, no uart reporting so callers decide how to surface errors
+static esp_err_t mesh_send_vendor(uint16_t dst_address, uint32_t opcode, uint16_t length, uint8_t *data_ptr, bool require_response)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {0};
+    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
+
+    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
+    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
+    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+
+    // check if node is in network
+    esp_ble_mesh_node_t *node = NULL;
+    node = esp_ble_mesh_provisioner_get_node_with_addr(dst_address);
+    if (node == NULL)
+    {
+        ESP_LOGE(TAG, "Node 0x%04x not exists in network", dst_address);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ctx.net_idx = ble_mesh_key.net_idx;
+    ctx.app_idx = ble_mesh_key.app_idx;
+    ctx.addr = dst_address;
+    ctx.send_ttl = get_node_ttl(dst_address);
+
+    esp_err_t err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, get_node_timeout(dst_address), require_response, message_role);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", dst_address, err);
+    }
+    return err;
+}
+
+// broadcast one vendor message, no uart reporting
+static esp_err_t mesh_broadcast(uint16_t length, uint8_t *data_ptr)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {0};
+    uint32_t opcode = ECS_193_MODEL_OP_BROADCAST;
+    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
+
+    ctx.net_idx = ble_mesh_key.net_idx;
+    ctx.app_idx = ble_mesh_key.app_idx;
+    ctx.addr = 0xFFFF;
+    ctx.send_ttl = ble_message_ttl;
+
+    esp_err_t err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, false, message_role);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to node addr 0xFFFF, err_code %d", err);
+    }
+    return err;
+}
+
+// stack out of buffers or tx contexts, the send is worth another try once the bearer drained
+// (-EBUSY is not congestion, the client refuses a second request to a node until the first one ended)
+static bool tx_admit_congested(int err_code)
+{
+    return (err_code == -ENOBUFS || err_code == -ENOMEM || err_code == -EAGAIN || err_code == ESP_ERR_NO_MEM);
+}
+
+// broadcasts are not reported, only plain messages
+static void tx_admit_report_failed(uint16_t dst_address, uint32_t opcode)
+{
+    if (opcode == ECS_193_MODEL_OP_MESSAGE || opcode == ECS_193_MODEL_OP_MESSAGE_R) {
+        uart_sendMsg(dst_address, "Failed to send to Node\n");
+    }
+}
+
+// outcome of an admitted send goes only to the owner that queued it, called without tx_lock held
+static void tx_admit_outcome(uint8_t owner, uint16_t tag, uint16_t dst_address, uint32_t opcode, uint8_t status)
+{
+    switch (owner) {
+    case TX_OWNER_TAGGED:
+        tagged_send_outcome(tag, status);
+        break;
+    case TX_OWNER_FANOUT:
+        fanout_send_outcome(tag, status);
+        break;
+    case TX_OWNER_XFER:
+        xfer_send_outcome(tag, status);
+        break;
+    default:
+        if (status == MESH_SEND_FAILED) {
+            tx_admit_report_failed(dst_address, opcode);
+        }
+        break;
+    }
+}
+
+// tell host to pause or resume when the queue crosses a watermark, called without tx_lock held
+static void tx_admit_notify(bool paused, uint8_t queued)
+{
+    ESP_LOGW(TAG, "Mesh tx queue %s, %d queued", paused ? "XOFF" : "XON", queued);
+    if (tx_flow_handler_cb != NULL) {
+        tx_flow_handler_cb(paused, queued);
+    }
+}
+
+// tx_lock held, returns true if host must be told to pause
+static bool tx_admit_queue(mesh_tx_entry_t *entry)
+{
+    entry->state = TX_ENTRY_QUEUED;
+    tx_admit.queued++;
+    if (!tx_admit.paused && tx_admit.queued >= MESH_TX_QUEUE_XOFF) {
+        tx_admit.paused = true;
+        return true;
+    }
+    return false;
+}
+
+// tx_lock held, stack had no room, back off and retry the entry first
+static bool tx_admit_requeue(mesh_tx_entry_t *entry)
+{
+    entry->retries++;
+    tx_admit.interval_us *= 2;
+    if (tx_admit.interval_us > MESH_FANOUT_INTERVAL_MS * 1000 * MESH_TX_MAX_BACKOFF) {
+        tx_admit.interval_us = MESH_FANOUT_INTERVAL_MS * 1000 * MESH_TX_MAX_BACKOFF;
+    }
+    return tx_admit_queue(entry);
+}
+
+// tx_lock held, stack still holds a request to the node, keep the entry back and give back the bucket tokens
+// its admission took since nothing went on air, released by the response or timeout of that request,
+// the node timeout (at least MESH_TX_HOLD_MIN_MS, a node without samples has none) is only a backstop
+static bool tx_admit_hold(mesh_tx_entry_t *entry)
+{
+    uint32_t hold_ms = get_node_timeout(entry->dst_address);
+    if (hold_ms < MESH_TX_HOLD_MIN_MS) {
+        hold_ms = MESH_TX_HOLD_MIN_MS;
+    }
+    entry->hold_until = esp_timer_get_time() + (int64_t) hold_ms * 1000;
+    tx_admit.tat -= mesh_message_segments(entry->length) * tx_admit.interval_us;
+    return tx_admit_queue(entry);
+}
+
+// tx_lock held, entry may go to the stack now: oldest queued to its node, not held, and a request only while
+// the stack has none to that node waiting for its response
+static bool tx_admit_ready(const mesh_tx_entry_t *entry, int64_t now)
+{
+    if (entry->hold_until > now) {
+        return false;
+    }
+    for (int i = 0; i < ARRAY_SIZE(tx_entries); i++) {
+        const mesh_tx_entry_t *other = &tx_entries[i];
+        if (other == entry || other->dst_address != entry->dst_address) {
+            continue;
+        }
+        if (other->state == TX_ENTRY_QUEUED && (int32_t) (other->seq - entry->seq) < 0) {
+            return false;
+        }
+        if (entry->require_response && other->state == TX_ENTRY_SENDING && other->require_response) {
+            return false;
+        }
+    }
+    if (entry->require_response) {
+        esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(entry->dst_address);
+        if (node != NULL && node->rsp_opcode != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t tx_admit_enqueue(uint16_t dst_address, uint32_t opcode, uint16_t length, uint8_t *data_ptr, bool require_response,
+    uint8_t owner, uint16_t tag)
+{
+    mesh_tx_entry_t *entry = NULL;
+    bool pause = false;
+    uint8_t queued = 0;
+
+    portENTER_CRITICAL(&tx_lock);
+    for (int i = 0; i < ARRAY_SIZE(tx_entries); i++) {
+        if (tx_entries[i].state == TX_ENTRY_FREE) {
+            entry = &tx_entries[i];
+            entry->dst_address = dst_address;
+            entry->opcode = opcode;
+            entry->seq = tx_admit.next_seq++;
+            entry->length = length;
+            entry->retries = 0;
+            entry->owner = owner;
+            entry->tag = tag;
+            entry->hold_until = 0;
+            entry->require_response = require_response;
+            memcpy(entry->data, data_ptr, length);
+            pause = tx_admit_queue(entry);
+            queued = tx_admit.queued;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&tx_lock);
+
+    if (entry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (pause) {
+        tx_admit_notify(true, queued);
+    }
+    tx_admit_drain();
+    return ESP_OK;
+}
+
+// hand queued entries to the stack while the bucket allows, otherwise wake up when it refilled enough
+static void tx_admit_drain(void)
+{
+    while (1) {
+        mesh_tx_entry_t *entry = NULL;
+        int64_t wait_us = 0;
+        bool resume = false;
+        uint8_t queued = 0;
+
+        portENTER_CRITICAL(&tx_lock);
+        if (tx_admit.draining) {
+            portEXIT_CRITICAL(&tx_lock);
+            return; // the draining task picks up the new entry
+        }
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < ARRAY_SIZE(tx_entries); i++) {
+            mesh_tx_entry_t *candidate = &tx_entries[i];
+            if (candidate->state != TX_ENTRY_QUEUED) {
+                continue;
+            }
+            if (candidate->hold_until > now && (wait_us == 0 || candidate->hold_until - now < wait_us)) {
+                wait_us = candidate->hold_until - now; // backstop of a held entry
+            }
+            if (tx_admit_ready(candidate, now) && (entry == NULL || (int32_t) (candidate->seq - entry->seq) < 0)) {
+                entry = candidate;
+            }
+        }
+        if (entry != NULL) {
+            uint32_t segments = mesh_message_segments(entry->length);
+            int64_t tolerance = (segments < MESH_TX_BURST_SEGMENTS ? MESH_TX_BURST_SEGMENTS - segments : 0) * tx_admit.interval_us;
+            if (tx_admit.tat < now) {
+                tx_admit.tat = now;
+            }
+
+            if (tx_admit.tat - now > tolerance) {
+                wait_us = tx_admit.tat - now - tolerance;
+                entry = NULL;
+            } else {
+                tx_admit.tat += segments * tx_admit.interval_us;
+                entry->state = TX_ENTRY_SENDING;
+                tx_admit.queued--;
+                tx_admit.draining = true;
+                if (tx_admit.paused && tx_admit.queued <= MESH_TX_QUEUE_XON) {
+                    tx_admit.paused = false;
+                    resume = true;
+                }
+                queued = tx_admit.queued;
+            }
+        }
+        portEXIT_CRITICAL(&tx_lock);
+
+        if (entry == NULL) {
+            if (wait_us > 0 && !esp_timer_is_active(tx_timer)) {
+                esp_timer_start_once(tx_timer, wait_us);
+            }
+            return;
+        }
+        if (resume) {
+            tx_admit_notify(false, queued);
+        }
+
+        esp_err_t err;
+        if (entry->opcode == ECS_193_MODEL_OP_BROADCAST) {
+            err = mesh_broadcast(entry->length, entry->data);
+        } else {
+            err = mesh_send_vendor(entry->dst_address, entry->opcode, entry->length, entry->data, entry->require_response);
+        }
+
+        mesh_tx_entry_t done = *entry;
+        bool pause = false;
+        bool failed = false;
+        bool congested = false;
+        portENTER_CRITICAL(&tx_lock);
+        tx_admit.draining = false;
+        if (err == -EBUSY) {
+            pause = tx_admit_hold(entry);
+        } else if (err != ESP_OK) {
+            if (tx_admit_congested(err) && entry->retries < MESH_TX_MAX_RETRIES) {
+                pause = tx_admit_requeue(entry);
+                congested = true;
+            } else {
+                entry->state = TX_ENTRY_FREE;
+                failed = true;
+            }
+        }
+        queued = tx_admit.queued;
+        portEXIT_CRITICAL(&tx_lock);
+
+        if (pause) {
+            tx_admit_notify(true, queued);
+        }
+        if (failed) {
+            tx_admit_outcome(done.owner, done.tag, done.dst_address, done.opcode, MESH_SEND_FAILED);
+        }
+        if (congested) {
+            esp_timer_start_once(tx_timer, tx_admit.interval_us);
+            return; // give the stack time to free buffers
+        }
+    }
+}
+
+static void tx_admit_timer_cb(void* arg)
+{
+    tx_admit_drain();
+}
+
+// outcome of an admitted send, stack may still fail it for lack of buffers after the call returned
+static void tx_admit_send_comp(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode, int err_code)
+{
+    mesh_tx_entry_t *entry = NULL;
+    mesh_tx_entry_t done = {0};
+    bool pause = false;
+    bool retry = false;
+    uint8_t status = MESH_SEND_OK;
+    uint8_t queued = 0;
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&tx_lock);
+    for (int i = 0; i < ARRAY_SIZE(tx_entries); i++) {
+        mesh_tx_entry_t *candidate = &tx_entries[i];
+        if (candidate->state == TX_ENTRY_SENDING && candidate->dst_address == ctx->addr && candidate->opcode == opcode &&
+            (entry == NULL || (int32_t) (candidate->seq - entry->seq) < 0)) {
+            entry = candidate;
+        }
+    }
+
+    if (entry != NULL) {
+        done = *entry;
+        if (err_code == 0) {
+            entry->state = TX_ENTRY_FREE;
+            // stack keeps up, win back spacing step by step so the rate settles below the drop point
+            tx_admit.interval_us -= MESH_FANOUT_INTERVAL_MS * 1000 / 8;
+            if (tx_admit.interval_us < MESH_FANOUT_INTERVAL_MS * 1000) {
+                tx_admit.interval_us = MESH_FANOUT_INTERVAL_MS * 1000;
+            }
+            if (entry->require_response) {
+                // stack holds it until response or timeout, both come back by node only
+                esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(entry->dst_address);
+                if (node != NULL) {
+                    node->rsp_opcode = entry->opcode;
+                    node->rsp_owner = entry->owner;
+                    node->rsp_tag = entry->tag;
+                    // timed from the handoff the stack accepted, a refused send never overwrites it
+                    node->rtt_sent = (entry->opcode == ECS_193_MODEL_OP_MESSAGE_R ? esp_timer_get_time() : 0);
+                } else {
+                    status = MESH_SEND_FAILED; // no node record to take the response
+                }
+            }
+        } else if (err_code == -EBUSY) {
+            pause = tx_admit_hold(entry);
+            retry = true;
+        } else if (tx_admit_congested(err_code) && entry->retries < MESH_TX_MAX_RETRIES) {
+            pause = tx_admit_requeue(entry);
+            retry = true;
+        } else {
+            entry->state = TX_ENTRY_FREE;
+            status = MESH_SEND_FAILED;
+        }
+        queued = tx_admit.queued;
+    }
+    portEXIT_CRITICAL(&tx_lock);
+
+    if (entry == NULL) {
+        return;
+    }
+    if (pause) {
+        tx_admit_notify(true, queued);
+    }
+    if (!retry) {
+        tx_admit_outcome(done.owner, done.tag, done.dst_address, done.opcode, status);
+    } else if (!esp_timer_is_active(tx_timer)) {
+        esp_timer_start_once(tx_timer, tx_admit.interval_us); // drained from the timer task, not from the btc task
+    }
+}
+
+// the node's pending request got its response or timed out, report it to its owner and release the sends held
+// behind it one bearer interval later, the stack frees the request only after this callback
+static void tx_admit_response(uint16_t dst_address, uint8_t status)
+{
+    esp_ble_mesh_node_info_t *node = NULL;
+    uint32_t opcode = 0;
+    uint8_t owner = TX_OWNER_PLAIN;
+    uint16_t tag = 0;
+    uint8_t queued = 0;
+    int64_t release = esp_timer_get_time() + MESH_FANOUT_INTERVAL_MS * 1000;
+
+    portENTER_CRITICAL(&tx_lock);
+    node = example_ble_mesh_get_node_info(dst_address);
+    if (node != NULL && node->rsp_opcode != 0) {
+        opcode = node->rsp_opcode;
+        owner = node->rsp_owner;
+        tag = node->rsp_tag;
+        node->rsp_opcode = 0;
+    }
+    for (int i = 0; i < ARRAY_SIZE(tx_entries); i++) {
+        if (tx_entries[i].state == TX_ENTRY_QUEUED && tx_entries[i].dst_address == dst_address && tx_entries[i].hold_until > release) {
+            tx_entries[i].hold_until = release;
+        }
+    }
+    queued = tx_admit.queued;
+    portEXIT_CRITICAL(&tx_lock);
+
+    if (opcode != 0) {
+        tx_admit_outcome(owner, tag, dst_address, opcode, status);
+    }
+    if (queued > 0) {
+        esp_timer_stop(tx_timer);
+        esp_timer_start_once(tx_timer, MESH_FANOUT_INTERVAL_MS * 1000);
+    }
+}
+
+esp_err_t send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response)
+{
+    if (length > MESH_MSG_MAX_LEN) {
+        uart_sendMsg(dst_address, "Failed to send to Node\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (esp_ble_mesh_provisioner_get_node_with_addr(dst_address) == NULL) {
+        ESP_LOGE(TAG, "Node 0x%04x not exists in network", dst_address);
+        uart_sendMsg(dst_address, "Node not exists in network\n");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t opcode = (require_response ? ECS_193_MODEL_OP_MESSAGE_R : ECS_193_MODEL_OP_MESSAGE);
+    esp_err_t err = tx_admit_enqueue(dst_address, opcode, length, data_ptr, require_response, TX_OWNER_PLAIN, 0);
+    if (err == ESP_ERR_NO_MEM) {
+        ESP_LOGE(TAG, "Mesh tx queue full, message to 0x%04x dropped", dst_address);
+        uart_sendMsg(dst_address, "Error: Mesh TX Queue Full\n");
+    }
+
+    // ESP_LOGW(TAG, "Message [%s] sended to [0x%04x]", (char*) data_ptr, dst_address);
+    return err;
+}
+
+// advertising segments taken by a vendor message, unsegmented access pdu is up to 11 byte, segments carry 12 byte
+static uint32_t mesh_message_segments(uint16_t length)
+{
+    uint32_t access_length = 3 + length; // 3 byte vendor opcode
+    if (access_length <= 11) {
+        return 1;
+    }
+    return (access_length + 4 + 11) / 12; // 4 byte TransMIC
+}
+
+// every destination queued and every queue outcome back, report the summary and free the fan-out
+static void fanout_complete(void)
+{
+    ESP_LOGI(TAG, "Fan-out of %d bytes to %d nodes finished", fanout.length, fanout.dst_count);
+    void (*complete_handler)(const uint16_t *, const uint8_t *, uint8_t) = fanout.complete_handler;
+    if (complete_handler != NULL) {
+        complete_handler(fanout.dst_addresses, fanout.results, fanout.dst_count);
+    }
+    fanout.active = false;
+}
+
+// sends one destination per timer tick so the advertising bearer is never flooded, spacing scales with segments
+static void fanout_send_next(void* arg)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    uint8_t index = fanout.index;
+
+    if (index < fanout.dst_count) {
+        uint16_t dst_address = fanout.dst_addresses[index];
+        if (esp_ble_mesh_provisioner_get_node_with_addr(dst_address) != NULL) {
+            // counted before the queue may report the outcome, even from inside the enqueue
+            portENTER_CRITICAL(&fanout_lock);
+            fanout.results[index] = MESH_SEND_OK;
+            fanout.outstanding++;
+            portEXIT_CRITICAL(&fanout_lock);
+            err = tx_admit_enqueue(dst_address, ECS_193_MODEL_OP_MESSAGE, fanout.length, fanout.data, false, TX_OWNER_FANOUT,
+                (fanout.generation << 8) | index);
+        }
+    }
+
+    portENTER_CRITICAL(&fanout_lock);
+    if (index < fanout.dst_count) {
+        if (err == ESP_ERR_NOT_FOUND) {
+            fanout.results[index] = MESH_SEND_NO_NODE;
+        } else if (err != ESP_OK) {
+            fanout.results[index] = MESH_SEND_FAILED;
+            fanout.outstanding--; // never queued, no outcome follows
+        }
+        fanout.index++;
+    }
+    bool more = (fanout.index < fanout.dst_count);
+    bool complete = (!more && fanout.outstanding == 0);
+    portEXIT_CRITICAL(&fanout_lock);
+
+    if (more) {
+        // skipped destinations didn't use the bearer, move on right away
+        uint64_t delay_us = (err == ESP_OK ? fanout.interval_us : 0);
+        esp_timer_start_once(fanout_timer, delay_us);
+    } else if (complete) {
+        fanout_complete();
+    }
+    // otherwise the last queue outcome completes it
+}
+
+// outcome of a queued destination, a failure corrects its result, the last one of the fan-out completes it
+static void fanout_send_outcome(uint16_t tag, uint8_t status)
+{
+    uint8_t index = tag & 0xFF;
+    bool complete = false;
+
+    portENTER_CRITICAL(&fanout_lock);
+    if (fanout.active && (tag >> 8) == fanout.generation && index < fanout.dst_count && fanout.outstanding > 0) {
+        if (status != MESH_SEND_OK) {
+            fanout.results[index] = MESH_SEND_FAILED;
+        }
+        fanout.outstanding--;
+        complete = (fanout.index >= fanout.dst_count && fanout.outstanding == 0);
+    }
+    portEXIT_CRITICAL(&fanout_lock);
+
+    if (complete) {
+        fanout_complete();
+    }
+}
+
+// outcome of the tagged send in slot, reported by the tx queue that sent it
+static void tagged_send_outcome(uint16_t slot, uint8_t status)
+{
+    tagged_send_t done = {0};
+    int64_t now = esp_timer_get_time();
+
+    if (slot >= ARRAY_SIZE(tagged_sends)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&tagged_lock);
+    tagged_send_t *entry = &tagged_sends[slot];
+    if (entry->state == TAGGED_WAIT_SEND && status == MESH_SEND_OK && entry->require_response) {
+        entry->state = TAGGED_WAIT_RESPONSE; // on air, outcome comes with the response or timeout
+    } else if (entry->state != TAGGED_FREE) {
+        done = *entry;
+        entry->state = TAGGED_FREE;
+    }
+    portEXIT_CRITICAL(&tagged_lock);
+
+    if (done.state != TAGGED_FREE && done.complete_handler != NULL) {
+        done.complete_handler(done.request_id, done.dst_address, status, (uint32_t) (now - done.start_time));
+    }
+}
+
+esp_err_t send_tagged_message(uint16_t request_id, uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response,
+    void (*complete_handler)(uint16_t request_id, uint16_t dst_address, uint8_t status, uint32_t latency_us))
+{
+    tagged_send_t *entry = NULL;
+    uint16_t slot = 0;
+
+    if (length > MESH_MSG_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (esp_ble_mesh_provisioner_get_node_with_addr(dst_address) == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // tracked before the send, the tx queue may report the outcome before tx_admit_enqueue() returns
+    portENTER_CRITICAL(&tagged_lock);
+    for (int i = 0; i < ARRAY_SIZE(tagged_sends); i++) {
+        if (tagged_sends[i].state == TAGGED_FREE) {
+            entry = &tagged_sends[i];
+            slot = i;
+            entry->request_id = request_id;
+            entry->dst_address = dst_address;
+            entry->start_time = esp_timer_get_time();
+            entry->require_response = require_response;
+            entry->complete_handler = complete_handler;
+            entry->state = TAGGED_WAIT_SEND;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&tagged_lock);
+
+    if (entry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // paced and matched to its completion by the tx queue like every other send, outcome comes back by slot
+    uint32_t opcode = (require_response ? ECS_193_MODEL_OP_MESSAGE_R : ECS_193_MODEL_OP_MESSAGE);
+    esp_err_t err = tx_admit_enqueue(dst_address, opcode, length, data_ptr, require_response, TX_OWNER_TAGGED, slot);
+    if (err != ESP_OK) {
+        portENTER_CRITICAL(&tagged_lock);
+        entry->state = TAGGED_FREE;
+        portEXIT_CRITICAL(&tagged_lock);
+    }
+    return err;
+}
+
+esp_err_t send_message_multi(const uint16_t *dst_addresses, uint8_t dst_count, uint16_t length, uint8_t *data_ptr,
+    void (*complete_handler)(const uint16_t *dst_addresses, const uint8_t *results, uint8_t dst_count))
+{
+    if (dst_count == 0 || dst_count > MESH_FANOUT_MAX_DST || length == 0 || length > MESH_MSG_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fanout.active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(fanout.dst_addresses, dst_addresses, dst_count * sizeof(uint16_t));
+    memcpy(fanout.data, data_ptr, length);
+    fanout.dst_count = dst_count;
+    fanout.length = length;
+    fanout.index = 0;
+    fanout.outstanding = 0;
+    fanout.generation++;
+    fanout.interval_us = mesh_message_segments(length) * MESH_FANOUT_INTERVAL_MS * 1000;
+    fanout.complete_handler = complete_handler;
+    fanout.active = true;
+
+    esp_err_t err = esp_timer_start_once(fanout_timer, 0);
+    if (err != ESP_OK) {
+        fanout.active = false;
+    }
+    return err;
+}
+
+// bytes of the transfer covered by chunks before index
+static uint32_t xfer_chunk_offset(uint16_t index)
+{
+    uint32_t offset = (uint32_t) index * MESH_XFER_CHUNK_LEN;
+    return (offset < xfer.total_length ? offset : xfer.total_length);
+}
+
+static void xfer_send_chunk(uint16_t index, bool ack_request)
+{
+    uint8_t buffer[XFER_CHUNK_HEADER_LEN + MESH_XFER_CHUNK_LEN];
+    uint16_t length = xfer_chunk_offset(index + 1) - xfer_chunk_offset(index);
+
+    buffer[0] = xfer.transfer_id;
+    buffer[1] = (ack_request ? XFER_FLAG_ACK_REQ : 0);
+    buffer[2] = index & 0xFF;
+    buffer[3] = index >> 8;
+    buffer[4] = xfer.chunk_count & 0xFF;
+    buffer[5] = xfer.chunk_count >> 8;
+    memcpy(buffer + XFER_CHUNK_HEADER_LEN, xfer.window[index % MESH_XFER_WINDOW], length);
+
+    if (ack_request) {
+        portENTER_CRITICAL(&xfer_lock);
+        xfer.ack_queued = true;
+        xfer.ack_chunk = index;
+        portEXIT_CRITICAL(&xfer_lock);
+    }
+
+    // queue full counts as lost on air, resent after the ack timeout
+    esp_err_t err = tx_admit_enqueue(xfer.dst_address, ECS_193_MODEL_OP_CHUNK, XFER_CHUNK_HEADER_LEN + length, buffer, false, TX_OWNER_XFER, index);
+    if (err != ESP_OK && ack_request) {
+        portENTER_CRITICAL(&xfer_lock);
+        xfer.ack_queued = false;
+        portEXIT_CRITICAL(&xfer_lock);
+    }
+}
+
+// ack timeout runs from the handoff of the ack request chunk, the chunks before it went out at the bearer pace
+// already, the chunk itself still needs its segments on air, called without xfer_lock held
+static void xfer_arm_ack_timeout(uint16_t index)
+{
+    uint16_t length = XFER_CHUNK_HEADER_LEN + xfer_chunk_offset(index + 1) - xfer_chunk_offset(index);
+
+    portENTER_CRITICAL(&tx_lock);
+    int64_t air_us = mesh_message_segments(length) * tx_admit.interval_us;
+    portEXIT_CRITICAL(&tx_lock);
+
+    esp_timer_stop(xfer_timer);
+    esp_timer_start_once(xfer_timer, MESH_XFER_ACK_TIMEOUT_MS * 1000 + air_us);
+}
+
+// outcome of a chunk from the tx queue, only the pending ack request chunk matters, a failed one is lost on air
+static void xfer_send_outcome(uint16_t index, uint8_t status)
+{
+    bool arm = false;
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (xfer.active && xfer.ack_queued && xfer.ack_chunk == index) {
+        xfer.ack_queued = false;
+        arm = !xfer.kick; // a pending ack run arms the timeout itself
+    }
+    portEXIT_CRITICAL(&xfer_lock);
+
+    if (arm) {
+        xfer_arm_ack_timeout(index);
+    }
+}
+
+// no ack request chunk waits for its handoff, the ack timeout starts now
+static void xfer_arm_idle(void)
+{
+    bool arm = false;
+
+    portENTER_CRITICAL(&xfer_lock);
+    arm = (xfer.active && xfer.base < xfer.next_send && !xfer.ack_queued);
+    portEXIT_CRITICAL(&xfer_lock);
+
+    if (arm && !esp_timer_is_active(xfer_timer)) {
+        esp_timer_start_once(xfer_timer, MESH_XFER_ACK_TIMEOUT_MS * 1000);
+    }
+}
+
+// send the chunks host filled that fit in the window, called from the dispatch task and the transfer timer
+static void xfer_send_ready(void)
+{
+    uint16_t first = 0;
+    uint16_t last = 0;
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (xfer.active) {
+        first = xfer.next_send;
+        while (xfer.next_send < xfer.base + MESH_XFER_WINDOW && xfer.next_send < xfer.chunk_count
+            && xfer_chunk_offset(xfer.next_send + 1) <= xfer.filled) {
+            xfer.next_send++;
+        }
+        last = xfer.next_send;
+    }
+    portEXIT_CRITICAL(&xfer_lock);
+
+    for (uint16_t index = first; index < last; index++) {
+        xfer_send_chunk(index, index == last - 1);
+    }
+    if (last > first) {
+        xfer_arm_idle();
+    }
+}
+
+static void xfer_finish(uint8_t status, uint32_t offset)
+{
+    void (*status_handler)(uint16_t, uint8_t, uint32_t) = NULL;
+    uint16_t dst_address = 0;
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (xfer.active) {
+        xfer.active = false;
+        status_handler = xfer.status_handler;
+        dst_address = xfer.dst_address;
+    }
+    portEXIT_CRITICAL(&xfer_lock);
+
+    esp_timer_stop(xfer_timer);
+    if (status_handler != NULL) {
+        status_handler(dst_address, status, offset);
+    }
+}
+
+// new ack or ack timeout, resend what the node is missing
+static void xfer_timer_cb(void* arg)
+{
+    uint16_t resend[MESH_XFER_WINDOW];
+    uint8_t resend_count = 0;
+    uint16_t resend_end = 0;
+    bool failed = false;
+    uint32_t offset = 0;
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (!xfer.active) {
+        portEXIT_CRITICAL(&xfer_lock);
+        return;
+    }
+    if (xfer.kick) {
+        // node got chunks past a gap, the gap is lost, resend it without waiting for the timeout
+        xfer.kick = false;
+        for (int bit = 7; bit >= 0 && resend_end == 0; bit--) {
+            if (xfer.sack & (1 << bit)) {
+                resend_end = xfer.base + 1 + bit;
+            }
+        }
+    } else if (xfer.base < xfer.next_send) {
+        if (++xfer.retries > MESH_XFER_MAX_RETRIES) {
+            failed = true;
+            offset = xfer_chunk_offset(xfer.base);
+        } else {
+            resend_end = xfer.next_send;
+        }
+    }
+    if (resend_end > xfer.next_send) {
+        resend_end = xfer.next_send;
+    }
+    for (uint16_t index = xfer.base; index < resend_end; index++) {
+        if (index == xfer.base || !(xfer.sack & (1 << (index - xfer.base - 1)))) {
+            resend[resend_count++] = index;
+        }
+    }
+    portEXIT_CRITICAL(&xfer_lock);
+
+    if (failed) {
+        ESP_LOGE(TAG, "Transfer to 0x%04x failed, no ack after %d tries", xfer.dst_address, MESH_XFER_MAX_RETRIES);
+        xfer_finish(MESH_XFER_FAILED, offset);
+        return;
+    }
+
+    for (int i = 0; i < resend_count; i++) {
+        xfer_send_chunk(resend[i], i == resend_count - 1);
+    }
+    xfer_send_ready();
+    xfer_arm_idle();
+}
+
+// | transfer id | 2 byte next expected index | bitmap |, bit i set when chunk (next expected + 1 + i) received
+static void xfer_recv_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr)
+{
+    bool progress = false;
+    bool done = false;
+    uint32_t offset = 0;
+    void (*status_handler)(uint16_t, uint8_t, uint32_t) = NULL;
+
+    if (length < 4) {
+        return;
+    }
+    uint16_t next_expected = msg_ptr[1] | (msg_ptr[2] << 8);
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (xfer.active && ctx->addr == xfer.dst_address && msg_ptr[0] == xfer.transfer_id
+        && next_expected >= xfer.base && next_expected <= xfer.next_send) {
+        if (next_expected > xfer.base) {
+            progress = true;
+            xfer.retries = 0;
+        }
+        xfer.base = next_expected;
+        xfer.sack = msg_ptr[3];
+        xfer.kick = true;
+        offset = xfer_chunk_offset(xfer.base);
+        done = (xfer.base == xfer.chunk_count);
+        status_handler = xfer.status_handler;
+    }
+    portEXIT_CRITICAL(&xfer_lock);
+
+    if (done) {
+        ESP_LOGI(TAG, "Transfer of %" PRIu32 " bytes to 0x%04x done", offset, ctx->addr);
+        xfer_finish(MESH_XFER_DONE, offset);
+    } else if (status_handler != NULL) {
+        if (progress) {
+            status_handler(ctx->addr, MESH_XFER_PROGRESS, offset); // window moved, host may stream more
+        }
+        // sends from the timer task, not from the btc task
+        esp_timer_stop(xfer_timer);
+        esp_timer_start_once(xfer_timer, 0);
+    }
+}
+
+esp_err_t transfer_open(uint16_t dst_address, uint32_t total_length,
+    void (*status_handler)(uint16_t dst_address, uint8_t status, uint32_t offset))
+{
+    if (total_length == 0 || (total_length + MESH_XFER_CHUNK_LEN - 1) / MESH_XFER_CHUNK_LEN > 0xFFFF) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (esp_ble_mesh_provisioner_get_node_with_addr(dst_address) == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (xfer.active) {
+        portEXIT_CRITICAL(&xfer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    xfer.transfer_id++; // node drops chunks of an older transfer
+    xfer.dst_address = dst_address;
+    xfer.total_length = total_length;
+    xfer.chunk_count = (total_length + MESH_XFER_CHUNK_LEN - 1) / MESH_XFER_CHUNK_LEN;
+    xfer.filled = 0;
+    xfer.base = 0;
+    xfer.next_send = 0;
+    xfer.sack = 0;
+    xfer.retries = 0;
+    xfer.kick = false;
+    xfer.ack_queued = false;
+    xfer.status_handler = status_handler;
+    xfer.active = true;
+    portEXIT_CRITICAL(&xfer_lock);
+
+    ESP_LOGI(TAG, "Transfer %d of %" PRIu32 " bytes to 0x%04x opened", xfer.transfer_id, total_length, dst_address);
+    status_handler(dst_address, MESH_XFER_PROGRESS, 0);
+    return ESP_OK;
 }
 
-void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response)
+esp_err_t transfer_write(uint32_t offset, uint16_t length, const uint8_t *data_ptr)
 {
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_MESSAGE;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err;
+    esp_err_t err = ESP_OK;
+    uint32_t resume_offset = 0;
+    void (*status_handler)(uint16_t, uint8_t, uint32_t) = NULL;
+    uint16_t dst_address = 0;
+
+    portENTER_CRITICAL(&xfer_lock);
+    if (!xfer.active) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (offset != xfer.filled || offset + length > xfer.total_length
+        || offset + length > xfer_chunk_offset(xfer.base) + MESH_XFER_WINDOW * MESH_XFER_CHUNK_LEN) {
+        // out of order or beyond the window, host resumes from the offset reported
+        err = ESP_ERR_INVALID_ARG;
+        resume_offset = xfer.filled;
+        status_handler = xfer.status_handler;
+        dst_address = xfer.dst_address;
+    } else {
+        // slots of chunks at or beyond base are never read by a resend of an acked chunk
+        for (uint32_t copied = 0; copied < length;) {
+            uint32_t position = offset + copied;
+            uint32_t in_chunk = position % MESH_XFER_CHUNK_LEN;
+            uint32_t piece = MESH_XFER_CHUNK_LEN - in_chunk;
+            if (piece > length - copied) {
+                piece = length - copied;
+            }
+            memcpy(xfer.window[(position / MESH_XFER_CHUNK_LEN) % MESH_XFER_WINDOW] + in_chunk, data_ptr + copied, piece);
+            copied += piece;
+        }
+        xfer.filled += length;
+    }
+    portEXIT_CRITICAL(&xfer_lock);
 
-    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
-    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
-    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+    if (status_handler != NULL) {
+        status_handler(dst_address, MESH_XFER_REJECTED, resume_offset);
+    }
+    if (err == ESP_OK) {
+        xfer_send_ready();
+    }
+    return err;
+}
 
-    // check if node is in network
-    esp_ble_mesh_node_t *node = NULL;
-    node = esp_ble_mesh_provisioner_get_node_with_addr(dst_address);
-    if (node == NULL)
-    {
-        ESP_LOGE(TAG, "Node 0x%04x not exists in network", dst_address);
-        uart_sendMsg(dst_address, "Node not exists in network\n");
-        return;
+void transfer_abort(void)
+{
+    uint32_t offset = 0;
+
+    portENTER_CRITICAL(&xfer_lock);
+    offset = xfer_chunk_offset(xfer.base);
+    portEXIT_CRITICAL(&xfer_lock);
+    xfer_finish(MESH_XFER_ABORTED, offset);
+}
+
+static uint8_t *message_pool_alloc(uint16_t length)
+{
+    uint8_t *block = NULL;
+    if (length <= MESH_SLAB_BLOCK_SIZE(MESH_POOL_SMALL_BLOCK)) {
+        block = mesh_slab_alloc(&pool_small);
+    }
+    if (block == NULL && length <= POOL_LARGE_BLOCK) {
+        block = mesh_slab_alloc(&pool_large);
+    }
+    return block;
+}
+
+static void message_pool_free(uint8_t *block)
+{
+    if (mesh_slab_owns(&pool_small, block)) {
+        mesh_slab_free(&pool_small, block);
+    } else {
+        mesh_slab_free(&pool_large, block);
+    }
+}
+
+uint8_t get_message_pool_stats(mesh_slab_stats_t *stats, uint8_t max_pools)
+{
+    uint8_t count = 0;
+    if (count < max_pools) {
+        mesh_slab_get_stats(&pool_small, &stats[count++]);
+    }
+    if (count < max_pools) {
+        mesh_slab_get_stats(&pool_large, &stats[count++]);
     }
+    return count;
+}
+
+// retransmits get one more ttl per 2 tries, a far node may have moved further away
+static esp_err_t important_send(uint16_t dst_address, uint8_t retransmits, uint16_t length, uint8_t *data_ptr)
+{
+    esp_ble_mesh_msg_ctx_t ctx = {0};
 
     ctx.net_idx = ble_mesh_key.net_idx;
     ctx.app_idx = ble_mesh_key.app_idx;
     ctx.addr = dst_address;
-    ctx.send_ttl = ble_message_ttl;
+    ctx.send_ttl = get_node_ttl(dst_address) + retransmits / 2;
 
-    if (require_response)
-    {
-        opcode = ECS_193_MODEL_OP_MESSAGE_R;
+    esp_err_t err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, ECS_193_MODEL_OP_MESSAGE_I, length, data_ptr, MSG_TIMEOUT, false, MSG_ROLE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send important message to node addr 0x%04x, err_code %d", dst_address, err);
     }
+    return err;
+}
 
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, require_response, message_role);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x", dst_address);
-        uart_sendMsg(dst_address, "Failed to send to Node\n");
-        return;
+// ack timeout of a try, doubles per retransmit up to MESH_RETX_MAX_TIMEOUT_MS, plus random jitter so messages
+// timing out together do not retransmit together
+static uint32_t important_backoff_ticks(uint32_t base_ms, uint8_t retransmits)
+{
+    uint32_t timeout_ms = MESH_RETX_MAX_TIMEOUT_MS;
+    if (retransmits < 16 && ((uint64_t) base_ms << retransmits) < MESH_RETX_MAX_TIMEOUT_MS) {
+        timeout_ms = base_ms << retransmits;
     }
+    timeout_ms += esp_random() % (timeout_ms * MESH_RETX_JITTER_PERCENT / 100 + 1);
+    return (timeout_ms + MESH_RETX_TICK_MS - 1) / MESH_RETX_TICK_MS;
+}
 
-    // ESP_LOGW(TAG, "Message [%s] sended to [0x%04x]", (char*) data_ptr, dst_address);
+// one-shot per tick, re-armed while the wheel holds messages, a send finding it idle starts it again
+static void important_tick_start(void)
+{
+    if (!esp_timer_is_active(important_timer)) {
+        esp_timer_start_once(important_timer, MESH_RETX_TICK_MS * 1000);
+    }
 }
 
-void send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr) {
-    int index = -1;
-    
-    for (int i=0; i<3; i++) {
-        if (important_message_data_list[i] == NULL) {
-            index = i;
+// acks overdue, resend or give up, at most MESH_RETX_MAX_PER_TICK per tick, the rest stay due for the next tick
+// one message at a time so an ack freeing it meanwhile is harmless
+static void important_timer_cb(void* arg)
+{
+    static uint8_t resend_data[MESH_MSG_MAX_LEN]; // timer task only
+
+    portENTER_CRITICAL(&important_lock);
+    mesh_wheel_advance(&important_wheel);
+    portEXIT_CRITICAL(&important_lock);
+
+    for (int budget = MESH_RETX_MAX_PER_TICK; budget > 0; budget--) {
+        important_message_t due = {0};
+        uint8_t *expired_data = NULL;
+        uint32_t backoff_ticks = 0;
+
+        portENTER_CRITICAL(&important_lock);
+        uint16_t index = mesh_wheel_pop_due(&important_wheel);
+        if (index != MESH_WHEEL_NONE) {
+            important_message_t *entry = &important_messages[index];
+            due = *entry;
+            if (entry->retransmits >= MESH_IMPORTANT_MAX_RETRANSMIT) {
+                entry->active = false;
+                expired_data = entry->data;
+                outbox_dirty[index] = true;
+            } else {
+                entry->retransmits++;
+                due.retransmits = entry->retransmits;
+                memcpy(resend_data, entry->data, entry->length);
+                backoff_ticks = important_backoff_ticks(entry->timeout_ms, entry->retransmits);
+                mesh_wheel_schedule(&important_wheel, index, backoff_ticks);
+            }
+        }
+        portEXIT_CRITICAL(&important_lock);
+
+        if (!due.active) {
             break;
         }
+        if (expired_data != NULL) {
+            ESP_LOGW(TAG, "Important message %d to 0x%04x not acked after %d retransmits", due.seq, due.dst_address, due.retransmits);
+            message_pool_free(expired_data);
+            outbox_schedule();
+            continue;
+        }
+
+        node_ttl_miss(due.dst_address);
+        ESP_LOGI(TAG, "Retransmit important message %d to 0x%04x, %d time, next in %" PRIu32 " ms",
+            due.seq, due.dst_address, due.retransmits, backoff_ticks * MESH_RETX_TICK_MS);
+        important_send(due.dst_address, due.retransmits, due.length, resend_data);
     }
 
-    if (index == -1) {
-        ESP_LOGW(TAG, "Too many on tracking important message, failed to add one more");
-        return;
+    portENTER_CRITICAL(&important_lock);
+    uint16_t pending = mesh_wheel_pending(&important_wheel);
+    portEXIT_CRITICAL(&important_lock);
+    if (pending > 0) {
+        important_tick_start();
     }
+}
 
-    // send message
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_MESSAGE;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
+static void important_recv_ack(uint16_t src_address, uint16_t seq)
+{
+    uint8_t *acked_data = NULL;
+    bool first_try = false;
+    int64_t sent_at = 0;
+
+    portENTER_CRITICAL(&important_lock);
+    for (int i = 0; i < ARRAY_SIZE(important_messages); i++) {
+        important_message_t *entry = &important_messages[i];
+        if (entry->active && entry->dst_address == src_address && entry->seq == seq) {
+            entry->active = false;
+            acked_data = entry->data;
+            first_try = (entry->retransmits == 0);
+            sent_at = entry->sent_at;
+            mesh_wheel_cancel(&important_wheel, i);
+            outbox_dirty[i] = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&important_lock);
 
-    ctx.net_idx = ble_mesh_key.net_idx;
-    ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = dst_address;
-    ctx.send_ttl = ble_message_ttl;
-    
-    if (index == 0) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_0;
-    } else if (index == 1) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_1;
-    } else if (index == 2) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_2;
-    } else {
-        ESP_LOGW(TAG, "Error Index: [%d] for important messasge", index);
+    if (acked_data == NULL) {
+        ESP_LOGW(TAG, "Ack of important message %d from 0x%04x not tracked, acked before or given up", seq, src_address);
         return;
     }
+    message_pool_free(acked_data);
+    outbox_schedule();
+    if (first_try) {
+        node_rtt_sample(src_address, (uint32_t) (esp_timer_get_time() - sent_at));
+    }
+    ESP_LOGI(TAG, "Important message %d delivered to 0x%04x", seq, src_address);
+}
+
+// track and send an important message, with a new sequence or with the one it had before a restart
+static esp_err_t important_track(uint16_t dst_address, uint16_t length, const uint8_t *data_ptr, bool replay, uint16_t replay_seq)
+{
+    if (length + IMPORTANT_SEQ_LEN > MESH_MSG_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
     // save the important message incase of need for resend
-    important_message_data_list[index] = (uint8_t*) malloc(length * sizeof(uint8_t));
-    important_message_data_lengths[index] = length;
-    important_message_retransmit_times[index] = 0;
-    
-    if (important_message_data_list[index] == NULL) {
-        ESP_LOGW(TAG, "Failed to allocate [%d] bytes for important messasge", length);
-        return;
+    uint8_t *data = message_pool_alloc(IMPORTANT_SEQ_LEN + length);
+    if (data == NULL) {
+        ESP_LOGW(TAG, "No buffer for [%d] bytes important messasge, pool empty", length);
+        return ESP_ERR_NO_MEM;
     }
-    memcpy(important_message_data_list[index], data_ptr, length);
-    
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, 
-        important_message_data_lengths[index], important_message_data_list[index], 
-        MSG_TIMEOUT, true, message_role);
-    
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send important message to node addr 0x%04x, err_code %d", dst_address, err);
-        return;
+    memcpy(data + IMPORTANT_SEQ_LEN, data_ptr, length);
+
+    important_message_t *entry = NULL;
+    uint16_t seq = 0;
+    uint32_t timeout_ms = get_node_timeout(dst_address);
+    if (timeout_ms == 0) {
+        timeout_ms = MESH_IMPORTANT_TIMEOUT_MS;
+    }
+    uint32_t timeout_ticks = important_backoff_ticks(timeout_ms, 0);
+    portENTER_CRITICAL(&important_lock);
+    for (int i = 0; i < ARRAY_SIZE(important_messages); i++) {
+        if (!important_messages[i].active) {
+            entry = &important_messages[i];
+            seq = (replay ? replay_seq : important_next_seq++);
+            data[0] = seq & 0xFF;
+            data[1] = seq >> 8;
+            entry->active = true;
+            entry->dst_address = dst_address;
+            entry->seq = seq;
+            entry->retransmits = 0;
+            entry->timeout_ms = timeout_ms;
+            entry->sent_at = esp_timer_get_time();
+            entry->length = IMPORTANT_SEQ_LEN + length;
+            entry->data = data;
+            mesh_wheel_schedule(&important_wheel, i, timeout_ticks);
+            outbox_dirty[i] = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&important_lock);
+
+    if (entry == NULL) {
+        ESP_LOGW(TAG, "Too many on tracking important message, failed to add one more");
+        message_pool_free(data);
+        return ESP_ERR_NO_MEM;
     }
+
+    // a failed first send is covered by the retransmits
+    important_send(dst_address, 0, IMPORTANT_SEQ_LEN + length, data);
+    important_tick_start();
+    outbox_schedule();
+    return ESP_OK;
 }
 
-int8_t get_important_message_index(uint32_t opcode) {
-    int8_t index = -1;
-    if (opcode == ECS_193_MODEL_OP_MESSAGE_I_0) {
-        index = 0;
-    } else if (opcode == ECS_193_MODEL_OP_MESSAGE_I_1) {
-        index = 1;
-    } else if (opcode == ECS_193_MODEL_OP_MESSAGE_I_2) {
-        index = 2;
+esp_err_t send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr) {
+    return important_track(dst_address, length, data_ptr, false, 0);
+}
+
+// first change since the last write starts the batch
+static void outbox_schedule(void)
+{
+    if (outbox_open && !esp_timer_is_active(outbox_timer)) {
+        esp_timer_start_once(outbox_timer, MESH_OUTBOX_FLUSH_MS * 1000);
     }
+}
 
-    return index;
+static void outbox_key(char *key, size_t size, int index)
+{
+    snprintf(key, size, "outbox%02d", index);
 }
 
-void retransmit_important_message(esp_ble_mesh_msg_ctx_t* ctx_ptr, uint32_t opcode, int8_t index) {
-    important_message_retransmit_times[index] += 1; // increment retransmit times count
+// write the changed entries, active ones as a record and freed ones erased, one commit for the batch
+// an entry failing to write stays changed and goes with the next batch
+static esp_err_t outbox_flush(void)
+{
+    esp_err_t result = ESP_OK;
+    bool changed = false;
 
-    if (important_message_retransmit_times[index] > 3) {
-        ESP_LOGW(TAG, "Error Index: [%d] for retransmiting important messasge", index);
+    if (!outbox_open) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // retransmit message
-    uint8_t tll_increment = important_message_retransmit_times[index] / 2; // add 1 more ttl per 2 times retransmit to limit ttl
-    ctx_ptr->send_ttl = ble_message_ttl + tll_increment;
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    for (int i = 0; i < ARRAY_SIZE(important_messages); i++) {
+        bool dirty = false;
+        bool active = false;
+        size_t length = 0;
+
+        portENTER_CRITICAL(&important_lock);
+        if (outbox_dirty[i]) {
+            const important_message_t *entry = &important_messages[i];
+            dirty = true;
+            active = entry->active;
+            outbox_dirty[i] = false;
+            if (active) {
+                // entry data already starts with its sequence
+                outbox_record[0] = entry->dst_address & 0xFF;
+                outbox_record[1] = entry->dst_address >> 8;
+                memcpy(outbox_record + OUTBOX_DST_LEN, entry->data, entry->length);
+                length = OUTBOX_DST_LEN + entry->length;
+            }
+        }
+        portEXIT_CRITICAL(&important_lock);
 
-    esp_err_t err = ESP_OK;
-    err = esp_ble_mesh_client_model_send_msg(client_model, ctx_ptr, opcode, 
-        important_message_data_lengths[index], important_message_data_list[index], 
-        MSG_TIMEOUT, true, MSG_ROLE);
-    
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to retransmit important message to node addr 0x%04x, err_code %d", ctx_ptr->addr, err);
-        ESP_LOGI(TAG, "clearing important_message, index: %d", index);
-        clear_important_message(index);
-        return;
+        if (!dirty) {
+            continue;
+        }
+
+        char key[16];
+        outbox_key(key, sizeof(key), i);
+        esp_err_t err = (active ? nvs_set_blob(outbox_nvs, key, outbox_record, length) : nvs_erase_key(outbox_nvs, key));
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            continue; // freed before it was ever written
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write outbox entry %d (err %d)", i, err);
+            portENTER_CRITICAL(&important_lock);
+            outbox_dirty[i] = true;
+            portEXIT_CRITICAL(&important_lock);
+            result = err;
+            continue;
+        }
+        changed = true;
     }
+
+    if (changed) {
+        esp_err_t err = nvs_commit(outbox_nvs);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to commit outbox (err %d)", err);
+            result = err;
+        }
+    }
+    xSemaphoreGive(outbox_mutex);
+    return result;
 }
 
-void clear_important_message(int8_t index) {
-    if (index < 0 || index > 2) {
-        ESP_LOGE(TAG, "Invaild index recived in clear_important_message(), index: %d", index);
-        return;
-    } else if (important_message_data_list[index] == NULL) {
-        ESP_LOGE(TAG, "Clearning an unused important message slot, index: %d", index);
-        return;
+// batch due, the flush itself runs in outbox_task so nvs never blocks the shared esp_timer task
+static void outbox_timer_cb(void* arg)
+{
+    xTaskNotifyGive(outbox_task_handle);
+}
+
+static void outbox_task(void* arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        outbox_flush();
+    }
+}
+
+// messages of the previous run still in the journal are sent again with their sequence, so an edge that got one
+// before the restart acks the repeat from its dedup cache instead of delivering it twice, their keys are rewritten
+// by the replayed messages or erased with the next batch
+static void outbox_replay(void)
+{
+    int replayed = 0;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    for (int i = 0; i < ARRAY_SIZE(important_messages); i++) {
+        char key[16];
+        size_t length = sizeof(outbox_record);
+
+        outbox_key(key, sizeof(key), i);
+        if (nvs_get_blob(outbox_nvs, key, outbox_record, &length) != ESP_OK) {
+            continue;
+        }
+
+        portENTER_CRITICAL(&important_lock);
+        outbox_dirty[i] = true;
+        portEXIT_CRITICAL(&important_lock);
+
+        if (length <= OUTBOX_DST_LEN + IMPORTANT_SEQ_LEN) {
+            continue;
+        }
+        uint16_t dst_address = outbox_record[0] | (outbox_record[1] << 8);
+        uint16_t seq = outbox_record[OUTBOX_DST_LEN] | (outbox_record[OUTBOX_DST_LEN + 1] << 8);
+        uint16_t header_len = OUTBOX_DST_LEN + IMPORTANT_SEQ_LEN;
+        if (important_track(dst_address, length - header_len, outbox_record + header_len, true, seq) == ESP_OK) {
+            replayed++;
+        }
+    }
+    xSemaphoreGive(outbox_mutex);
+
+    outbox_schedule();
+    if (replayed > 0) {
+        ESP_LOGI(TAG, "Replayed %d important messages from the outbox", replayed);
+    }
+}
+
+uint8_t get_outbox_entries(mesh_outbox_entry_t *entries, uint8_t max_entries)
+{
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&important_lock);
+    for (int i = 0; i < ARRAY_SIZE(important_messages) && count < max_entries; i++) {
+        const important_message_t *entry = &important_messages[i];
+        if (!entry->active) {
+            continue;
+        }
+        entries[count].dst_address = entry->dst_address;
+        entries[count].seq = entry->seq;
+        entries[count].retransmits = entry->retransmits;
+        entries[count].stored = (outbox_open && !outbox_dirty[i]);
+        entries[count].length = entry->length - IMPORTANT_SEQ_LEN;
+        count++;
     }
+    portEXIT_CRITICAL(&important_lock);
+    return count;
+}
+
+esp_err_t sync_outbox(void)
+{
+    esp_timer_stop(outbox_timer);
+    return outbox_flush();
+}
 
-    free(important_message_data_list[index]);
+esp_err_t clear_outbox(void)
+{
+    uint8_t *dropped_data[MESH_IMPORTANT_MAX_INFLIGHT];
+    int dropped = 0;
+
+    portENTER_CRITICAL(&important_lock);
+    for (int i = 0; i < ARRAY_SIZE(important_messages); i++) {
+        important_message_t *entry = &important_messages[i];
+        if (entry->active) {
+            entry->active = false;
+            mesh_wheel_cancel(&important_wheel, i);
+            dropped_data[dropped++] = entry->data;
+        }
+        outbox_dirty[i] = true;
+    }
+    portEXIT_CRITICAL(&important_lock);
 
-    important_message_data_list[index] = NULL;
-    important_message_data_lengths[index] = 0;
-    important_message_retransmit_times[index] = 0;
-    ESP_LOGI(TAG, "Important_message slot cleared, index: %d", index);
+    for (int i = 0; i < dropped; i++) {
+        message_pool_free(dropped_data[i]);
+    }
+    ESP_LOGI(TAG, "Dropped %d important messages from the outbox", dropped);
+    return sync_outbox();
 }
 
 void broadcast_message(uint16_t length, uint8_t *data_ptr)
+{
+    if (length > MESH_MSG_MAX_LEN) {
+        ESP_LOGE(TAG, "Broadcast of %d bytes too long", length);
+        return;
+    }
+
+    esp_err_t err = tx_admit_enqueue(0xFFFF, ECS_193_MODEL_OP_BROADCAST, length, data_ptr, false, TX_OWNER_PLAIN, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Mesh tx queue full, broadcast dropped");
+        uart_sendMsg(0, "Error: Mesh TX Queue Full\n");
+    }
+}
+
+esp_err_t add_group_members(uint16_t group_addr, const uint16_t *node_addrs, uint16_t node_count)
+{
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < node_count; i++) {
+        esp_err_t err = ESP_OK;
+        bool added = false;
+
+        // lookup and taking a free entry under one lock, the btc task frees entries concurrently
+        portENTER_CRITICAL(&group_lock);
+        mesh_group_member_t *member = group_find_member(group_addr, node_addrs[i]);
+        if (member != NULL) {
+            if (member->state == GROUP_SUB_DEL_PENDING) {
+                member->state = GROUP_SUBSCRIBED; // delete not sent yet, nothing to undo
+            } else if (member->state == GROUP_SUB_ADD_SENT_DEL) {
+                member->state = GROUP_SUB_ADD_SENT; // delete not applied yet, keep the add in flight
+            } else if (member->state == GROUP_SUB_DEL_SENT) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+        } else {
+            member = group_find_member(ESP_BLE_MESH_ADDR_UNASSIGNED, ESP_BLE_MESH_ADDR_UNASSIGNED);
+            if (member == NULL) {
+                err = ESP_ERR_NO_MEM;
+            } else {
+                member->group_addr = group_addr;
+                member->node_addr = node_addrs[i];
+                member->state = GROUP_SUB_ADD_PENDING;
+                added = true;
+            }
+        }
+        portEXIT_CRITICAL(&group_lock);
+
+        if (err == ESP_ERR_INVALID_STATE) {
+            ESP_LOGW(TAG, "Node 0x%04x still leaving group 0x%04x, add again later", node_addrs[i], group_addr);
+            result = err;
+        } else if (err == ESP_ERR_NO_MEM) {
+            ESP_LOGE(TAG, "Group membership table full, node 0x%04x not added to group 0x%04x", node_addrs[i], group_addr);
+            result = err;
+            break;
+        }
+        if (!added) {
+            continue;
+        }
+
+        // nodes still configuring (or not joined yet) get their subscriptions at the end of the config chain
+        esp_ble_mesh_node_info_t *node = example_ble_mesh_get_node_info(node_addrs[i]);
+        if (node != NULL && node->configured) {
+            group_sync_next(node_addrs[i]);
+        }
+    }
+    return result;
+}
+
+esp_err_t delete_group_members(uint16_t group_addr, const uint16_t *node_addrs, uint16_t node_count)
+{
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(group_members); i++) {
+        mesh_group_member_t *member = &group_members[i];
+        uint16_t sync_addr = ESP_BLE_MESH_ADDR_UNASSIGNED;
+
+        portENTER_CRITICAL(&group_lock);
+        bool listed = false;
+        if (member->group_addr == group_addr) {
+            listed = (node_count == 0); // empty list deletes the whole group
+            for (int j = 0; j < node_count && !listed; j++) {
+                listed = (member->node_addr == node_addrs[j]);
+            }
+        }
+
+        if (!listed) {
+            portEXIT_CRITICAL(&group_lock);
+            continue;
+        }
+
+        if (member->state == GROUP_SUB_ADD_PENDING) {
+            group_free_member(member); // never reached the node
+        } else if (member->state == GROUP_SUBSCRIBED) {
+            member->state = GROUP_SUB_DEL_PENDING;
+            sync_addr = member->node_addr;
+        } else if (member->state == GROUP_SUB_ADD_SENT) {
+            member->state = GROUP_SUB_ADD_SENT_DEL; // add in flight, delete once its status arrives
+        }
+        portEXIT_CRITICAL(&group_lock);
+
+        if (sync_addr != ESP_BLE_MESH_ADDR_UNASSIGNED) {
+            group_sync_next(sync_addr);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t send_group_message(uint16_t group_addr, uint16_t length, uint8_t *data_ptr)
 {
     esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_BROADCAST;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
 
-    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
-    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
-    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_addr)) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
     ctx.net_idx = ble_mesh_key.net_idx;
     ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = 0xFFFF;
+    ctx.addr = group_addr;
     ctx.send_ttl = ble_message_ttl;
-    
 
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, false, message_role);
+    // one transmission, relayed to the subscribed nodes only
+    esp_err_t err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, ECS_193_MODEL_OP_MESSAGE, length, data_ptr, MSG_TIMEOUT, false, MSG_ROLE);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send message to node addr 0xFFFF, err_code %d", err);
-        return;
+        ESP_LOGE(TAG, "Failed to send message to group addr 0x%04x, err_code %d", group_addr, err);
     }
+    return err;
 }
 
 void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_ptr, uint32_t message_opcode)
@@ -1217,6 +3431,9 @@ void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_p
     case ECS_193_MODEL_OP_MESSAGE_I_2:
         response_opcode = ECS_193_MODEL_OP_RESPONSE_I_2;
         break;
+    case ECS_193_MODEL_OP_MESSAGE_I:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE_I;
+        break;
     case ECS_193_MODEL_OP_CONNECTIVITY:
         response_opcode = ECS_193_MODEL_OP_RESPONSE;
         break;
@@ -1347,7 +3564,9 @@ esp_err_t esp_module_root_init(
     void (*recv_response_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode),
     void (*timeout_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode),
     void (*broadcast_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
-    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr)
+    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
+    void (*group_status_handler)(uint16_t group_addr, uint16_t node_addr, uint8_t status),
+    void (*tx_flow_handler)(bool paused, uint8_t queued)
 ) {
     esp_err_t err;
 
@@ -1361,9 +3580,12 @@ esp_err_t esp_module_root_init(
     timeout_handler_cb = timeout_handler;
     broadcast_handler_cb = broadcast_handler;
     connectivity_handler_cb = connectivity_handler;
+    group_status_handler_cb = group_status_handler;
+    tx_flow_handler_cb = tx_flow_handler;
     
     if (prov_complete_handler_cb == NULL || recv_message_handler_cb == NULL || recv_response_handler_cb == NULL 
-        || timeout_handler_cb == NULL || broadcast_handler_cb == NULL || connectivity_handler_cb == NULL || config_complete_handler_cb == NULL) {
+        || timeout_handler_cb == NULL || broadcast_handler_cb == NULL || connectivity_handler_cb == NULL || config_complete_handler_cb == NULL
+        || group_status_handler_cb == NULL || tx_flow_handler_cb == NULL) {
         ESP_LOGE(TAG, "Application Level Callback functin is NULL");
         return ESP_FAIL;
     }
@@ -1389,6 +3611,85 @@ esp_err_t esp_module_root_init(
 
     ble_mesh_get_dev_uuid(dev_uuid);
 
+    node_table_mutex = xSemaphoreCreateMutex(); // before the mesh callbacks can touch nodes[]
+    if (node_table_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create node table mutex");
+        return ESP_FAIL;
+    }
+
+    // timers, pools and the retransmit wheel exist before ble_mesh_init() enables the mesh callbacks that use them
+    const esp_timer_create_args_t fanout_timer_args = {
+        .callback = fanout_send_next,
+        .name = "mesh_fanout",
+    };
+    err = esp_timer_create(&fanout_timer_args, &fanout_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create fan-out timer (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    const esp_timer_create_args_t tx_timer_args = {
+        .callback = tx_admit_timer_cb,
+        .name = "mesh_tx_admit",
+    };
+    err = esp_timer_create(&tx_timer_args, &tx_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create tx admission timer (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    const esp_timer_create_args_t xfer_timer_args = {
+        .callback = xfer_timer_cb,
+        .name = "mesh_xfer",
+    };
+    err = esp_timer_create(&xfer_timer_args, &xfer_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create transfer timer (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    mesh_slab_init(&pool_small, &pool_small_memory[0][0], pool_small_links, sizeof(pool_small_memory[0]), MESH_POOL_SMALL_COUNT);
+    mesh_slab_init(&pool_large, &pool_large_memory[0][0], pool_large_links, sizeof(pool_large_memory[0]), MESH_POOL_LARGE_COUNT);
+    mesh_wheel_init(&important_wheel, important_wheel_slots, MESH_RETX_WHEEL_SLOTS, important_wheel_entries, MESH_IMPORTANT_MAX_INFLIGHT);
+
+    const esp_timer_create_args_t important_timer_args = {
+        .callback = important_timer_cb,
+        .name = "mesh_important",
+    };
+    err = esp_timer_create(&important_timer_args, &important_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create important message timer (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    const esp_timer_create_args_t ack_timer_args = {
+        .callback = ack_timer_cb,
+        .name = "mesh_ack",
+    };
+    err = esp_timer_create(&ack_timer_args, &ack_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create ack aggregation timer (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    // edges remember sequences for MESH_DEDUP_EXPIRY_MS, a restarted root must not start where it did before
+    important_next_seq = esp_random() & 0xFFFF;
+
+    outbox_mutex = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t outbox_timer_args = {
+        .callback = outbox_timer_cb,
+        .name = "mesh_outbox",
+    };
+    err = esp_timer_create(&outbox_timer_args, &outbox_timer);
+    if (outbox_mutex == NULL || err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create outbox timer (err %d)", err);
+        return ESP_FAIL;
+    }
+    if (xTaskCreate(outbox_task, "mesh_outbox_task", 1024 * 3, NULL, OUTBOX_TASK_PRIORITY, &outbox_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create outbox task");
+        return ESP_FAIL;
+    }
+
     /* Initialize the Bluetooth Mesh Subsystem */
     err = ble_mesh_init();
     if (err != ESP_OK) {
@@ -1396,13 +3697,17 @@ esp_err_t esp_module_root_init(
         return ESP_FAIL;
     }
 
-    if (important_message_data_list == NULL) {
-        important_message_data_list = (uint8_t**) malloc(3 * sizeof(uint8_t*));
-        for (int i=0; i<3; i++) {
-            important_message_data_list[i] = NULL;
-            important_message_retransmit_times[i] = 0;
-        }
+    topology_restore();
+
+#if MESH_OUTBOX_ENABLED
+    err = nvs_open(NVS_KEY_ROOT, NVS_READWRITE, &outbox_nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open outbox nvs (err %d), important messages kept in ram only", err);
+    } else {
+        outbox_open = true;
+        outbox_replay();
     }
+#endif
 
     return ESP_OK;
 }
\ No newline at end of file
@@ -16,10 +16,62 @@
 #include "ble_mesh_example_nvs.h"
 
 #include "../Secret/NetworkConfig.h"
+#include "mesh_slab.h"
 
 #ifndef _BLE_ROOT_H_
 #define _BLE_ROOT_H_
 
+// node known by root, kept in ram and rebuilt from the provisioner node table at boot
+typedef struct {
+    uint8_t  uuid[16];
+    uint16_t unicast;   // ESP_BLE_MESH_ADDR_UNASSIGNED marks a free entry
+    uint8_t  elem_num;
+    uint8_t  onoff;
+    bool     configured; // config chain (including group subscriptions) finished
+    bool     removed;    // deleted from network, kept so delta reports carry the removal
+    uint32_t version;    // topology version of the last change on this node
+    int64_t  last_seen;  // esp_timer time (us) of the last message from this node, 0 if never heard
+    int8_t   last_rssi;  // rssi of the last message from this node
+    uint8_t  last_ttl;   // remaining ttl of the last message from this node
+    uint8_t  hops;       // relays between root and node learned from received ttl, MESH_HOPS_UNKNOWN before first message
+    uint8_t  ttl_override; // ttl set by host, MESH_TTL_AUTO to use the learned one
+    uint32_t srtt_us;    // smoothed response time (RFC 6298), 0 before the first sample
+    uint32_t rttvar_us;  // response time variation
+    uint8_t  rto_backoff; // response timeouts since the last sample
+    int64_t  rtt_sent;   // esp_timer time (us) the stack completed the send of the pending MESSAGE_R, 0 if none
+    uint32_t rsp_opcode; // request the stack sent and holds until its response or timeout, 0 if none
+    uint8_t  rsp_owner;  // tx queue owner of that request, its outcome goes there
+    uint16_t rsp_tag;
+    uint8_t *sig_model_num;
+    uint8_t *vnd_model_num;
+    uint16_t **sig_models;
+    uint32_t **vnd_models;
+} esp_ble_mesh_node_info_t;
+
+#define MESH_HOPS_UNKNOWN   0xFF
+#define MESH_TTL_AUTO       0xFF // no host override, unicast ttl follows the learned hop count
+#define MESH_TTL_MAX        127
+
+// send result, per destination of send_message_multi() and per request of send_tagged_message()
+#define MESH_SEND_OK        0x00 // sent on the advertising bearer
+#define MESH_SEND_NO_NODE   0x01 // destination not in network
+#define MESH_SEND_FAILED    0x02 // mesh stack rejected or failed the send
+#define MESH_SEND_DELIVERED 0x03 // response received from destination
+#define MESH_SEND_TIMEOUT   0x04 // no response from destination in time
+#define MESH_SEND_BUSY      0x05 // too many tagged sends in flight, not sent
+
+// status reported to the transfer status_handler, offset meaning given per status
+#define MESH_XFER_PROGRESS  0x00 // bytes acked by the node, host may stream up to offset + MESH_XFER_WINDOW * MESH_XFER_CHUNK_LEN
+#define MESH_XFER_DONE      0x01 // node acked every chunk, offset is the total length
+#define MESH_XFER_FAILED    0x02 // no ack after MESH_XFER_MAX_RETRIES timeouts, offset is the bytes acked
+#define MESH_XFER_REJECTED  0x03 // data out of order or beyond the window, offset is where host resumes
+#define MESH_XFER_ABORTED   0x04 // transfer_abort(), offset is the bytes acked
+
+// status reported to group_status_handler
+#define MESH_GROUP_SUBSCRIBED   0x00
+#define MESH_GROUP_UNSUBSCRIBED 0x01
+#define MESH_GROUP_FAILED       0x02 // node rejected or never answered the subscription change, membership dropped
+
 /**
  * @brief Print Network Nodes in dev logs (esp log function)
  *
@@ -29,27 +81,193 @@ void printNetworkInfo();
 
 /**
  * @brief set the message ttl for current module.
+ *
+ *  Used for broadcast, group and for nodes without a learned hop count or override.
  */
 void set_message_ttl(uint8_t new_ttl);
 
+/**
+ * @brief Override the ttl of unicast messages to a node
+ *
+ * @param unicast Node's unicast address
+ * @param ttl Ttl 0 or 2 up to MESH_TTL_MAX, MESH_TTL_AUTO to go back to the learned hop count
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if node not in network, ESP_ERR_INVALID_ARG if ttl out of range
+ */
+esp_err_t set_node_ttl(uint16_t unicast, uint8_t ttl);
+
+/**
+ * @brief Get the ttl used for unicast messages to a node
+ *
+ *  Host override if set, otherwise learned hops + 1 + MESH_TTL_MARGIN, otherwise the module ttl.
+ *
+ * @param unicast Node's unicast address
+ * @return Ttl
+ */
+uint8_t get_node_ttl(uint16_t unicast);
+
+/**
+ * @brief Get the response timeout used for messages to a node
+ *
+ *  Learned from request/response pairs as smoothed rtt + 4 * rtt variation (RFC 6298), clamped to
+ *  MESH_RTO_MIN_MS..MESH_RTO_MAX_MS and doubled per response timeout until the next sample.
+ *
+ * @param unicast Node's unicast address
+ * @return Timeout in ms, MSG_TIMEOUT before the first sample
+ */
+uint32_t get_node_timeout(uint16_t unicast);
+
+/**
+ * @brief Get the topology version, bumped on node provision, reprovision, removal and config complete.
+ *
+ * @param epoch Out, random per boot, versions only compare within the same epoch
+ * @param floor Out, removals up to this version may be gone from the node table, older versions need the full table
+ * @return Current topology version
+ */
+uint32_t get_topology_version(uint32_t *epoch, uint32_t *floor);
+
+/**
+ * @brief Get the node table kept by root, entries with unicast ESP_BLE_MESH_ADDR_UNASSIGNED are free
+ *
+ * @param size Out, number of entries in the table
+ * @return Pointer to the node table, entries are updated by the mesh callbacks, read it under node_table_lock()
+ */
+const esp_ble_mesh_node_info_t *get_node_info_table(uint16_t *size);
+
+/**
+ * @brief Lock the node table against the mesh callbacks, they rebuild entries and free composition data
+ *
+ *  Held only while copying or serialising entries, never across a blocking call.
+ */
+void node_table_lock(void);
+
+/**
+ * @brief Unlock the node table locked by node_table_lock()
+ */
+void node_table_unlock(void);
+
 /**
  * @brief Send Message (bytes) to another node in network
  *
+ *  Message is copied into the tx admission queue and handed to the stack as the advertising bearer allows,
+ *  sends failed for lack of stack buffers are retried up to MESH_TX_MAX_RETRIES times.
+ *
  * @param dst_address  Dstination node's unicast address
  * @param length Length of message (bytes)
  * @param data_ptr pointer to data buffer that holds message
  * @param require_response flag that indicate if this message expecting response, timeout will get triger if response not recived
+ * @return ESP_OK if queued, ESP_ERR_NOT_FOUND if node not in network, ESP_ERR_NO_MEM if the tx queue is full
+ */
+esp_err_t send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
+
+/**
+ * @brief Send Message (bytes) to a node and report its outcome with the caller's request id
+ *
+ *  complete_handler is called once from the mesh stack callback: MESH_SEND_OK when sent without response
+ *  required, otherwise MESH_SEND_DELIVERED on response or MESH_SEND_TIMEOUT, and MESH_SEND_FAILED when the stack
+ *  fails the send. Up to MESH_TAGGED_MAX_INFLIGHT requests are tracked.
+ *
+ * @param request_id Id chosen by the caller, reported back in complete_handler
+ * @param dst_address Dstination node's unicast address
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message
+ * @param require_response flag that indicate if this message expecting response
+ * @param complete_handler Callback with the outcome and the latency from this call in us
+ * @return ESP_OK if sent (outcome follows in complete_handler), ESP_ERR_NOT_FOUND if node not in network,
+ *         ESP_ERR_NO_MEM if too many requests in flight or the tx queue is full, ESP_ERR_INVALID_ARG if too long
  */
-void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
+esp_err_t send_tagged_message(uint16_t request_id, uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response,
+    void (*complete_handler)(uint16_t request_id, uint16_t dst_address, uint8_t status, uint32_t latency_us));
 
 /**
- * @brief Broadcast Message (bytes) to all node in network
+ * @brief Send the same Message (bytes) to a list of nodes in network
+ *
+ *  The message is copied and sent to one destination at a time from a timer, spaced by MESH_FANOUT_INTERVAL_MS
+ *  per advertising segment so the advertising bearer is not flooded. Only one fan-out runs at a time.
+ *
+ * @param dst_addresses Dstination nodes' unicast addresses
+ * @param dst_count Number of destinations, up to MESH_FANOUT_MAX_DST
+ * @param length Length of message (bytes), up to MESH_MSG_MAX_LEN
+ * @param data_ptr pointer to data buffer that holds message
+ * @param complete_handler Callback with MESH_SEND_* result per destination once the stack reported every queued send,
+ *        from the timer or btc task, may be NULL
+ * @return ESP_OK if fan-out started, ESP_ERR_INVALID_STATE if another fan-out is running, ESP_ERR_INVALID_ARG on bad list or length
+ */
+esp_err_t send_message_multi(const uint16_t *dst_addresses, uint8_t dst_count, uint16_t length, uint8_t *data_ptr,
+    void (*complete_handler)(const uint16_t *dst_addresses, const uint8_t *results, uint8_t dst_count));
+
+/**
+ * @brief Open a chunked transfer of a payload larger than one mesh message to a node
+ *
+ *  Payload is written with transfer_write() as it arrives and sent as ECS_193_MODEL_OP_CHUNK messages, the node
+ *  acks chunk ranges with ECS_193_MODEL_OP_CHUNK_ACK. Only MESH_XFER_WINDOW chunks are buffered. One transfer at
+ *  a time, status_handler reports MESH_XFER_PROGRESS (0) right away.
+ *
+ * @param dst_address Dstination node's unicast address
+ * @param total_length Payload length (bytes), up to 65535 chunks
+ * @param status_handler Callback with MESH_XFER_* status and offset
+ * @return ESP_OK if opened, ESP_ERR_NOT_FOUND if node not in network, ESP_ERR_INVALID_STATE if a transfer is active
+ */
+esp_err_t transfer_open(uint16_t dst_address, uint32_t total_length,
+    void (*status_handler)(uint16_t dst_address, uint8_t status, uint32_t offset));
+
+/**
+ * @brief Append payload bytes to the open transfer
+ *
+ * @param offset Offset of data in the payload, must be the end of the bytes written so far
+ * @param length Length of data (bytes)
+ * @param data_ptr pointer to data buffer, copied
+ * @return ESP_OK if accepted, ESP_ERR_INVALID_STATE if no transfer, ESP_ERR_INVALID_ARG if out of order or beyond
+ *         the window (MESH_XFER_REJECTED reported with the offset to resume from)
+ */
+esp_err_t transfer_write(uint32_t offset, uint16_t length, const uint8_t *data_ptr);
+
+/**
+ * @brief Abort the open transfer, status_handler reports MESH_XFER_ABORTED
+ */
+void transfer_abort(void);
+
+/**
+ * @brief Broadcast Message (bytes) to all node in network, queued like send_message()
  *
  * @param length Length of message (bytes)
  * @param data_ptr pointer to data buffer that holds message
  */
 void broadcast_message(uint16_t length, uint8_t *data_ptr);
 
+/**
+ * @brief Add nodes to a group, root subscribes their vendor server model to the group address
+ *
+ *  Subscriptions are sent one at a time per node with Config Model Subscription Add. Nodes not configured yet
+ *  (or provisioned later) are subscribed at the end of their config chain, before config_complete_handler.
+ *  Every applied change is reported to group_status_handler.
+ *
+ * @param group_addr Group address (0xC000 - 0xFEFF)
+ * @param node_addrs Member nodes' unicast addresses
+ * @param node_count Number of nodes
+ * @return ESP_OK, ESP_ERR_INVALID_ARG on non group address, ESP_ERR_NO_MEM when MESH_GROUP_MAX_MEMBERSHIPS is reached
+ */
+esp_err_t add_group_members(uint16_t group_addr, const uint16_t *node_addrs, uint16_t node_count);
+
+/**
+ * @brief Remove nodes from a group with Config Model Subscription Delete
+ *
+ * @param group_addr Group address (0xC000 - 0xFEFF)
+ * @param node_addrs Nodes' unicast addresses to remove
+ * @param node_count Number of nodes, 0 removes every member of the group
+ * @return ESP_OK, ESP_ERR_INVALID_ARG on non group address
+ */
+esp_err_t delete_group_members(uint16_t group_addr, const uint16_t *node_addrs, uint16_t node_count);
+
+/**
+ * @brief Send Message (bytes) to every node subscribed to a group, one transmission instead of a unicast per node
+ *
+ * @param group_addr Group address (0xC000 - 0xFEFF)
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message
+ * @return ESP_OK if sent, ESP_ERR_INVALID_ARG on non group address
+ */
+esp_err_t send_group_message(uint16_t group_addr, uint16_t length, uint8_t *data_ptr);
+
 /**
  * @brief Send Response (bytes) to an recived message
  *
@@ -63,40 +281,62 @@ void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_p
 /**
  * @brief Send an Important Message (bytes) to an node
  * 
- *  This function send and tracks an important message, it will retransmit the important message with higher ttl after timeout for 2 times.
+ *  This function send and tracks an important message, it will retransmit the important message after
+ *  MESH_IMPORTANT_TIMEOUT_MS without ack, up to MESH_IMPORTANT_MAX_RETRANSMIT times with 1 more ttl per 2 times.
+ *  The timeout doubles per retransmit (capped at MESH_RETX_MAX_TIMEOUT_MS) with random jitter added.
+ *  Message carries a 2 byte sequence in front, the node acks with ECS_193_MODEL_OP_RESPONSE_I and the same sequence.
+ *  Up to MESH_IMPORTANT_MAX_INFLIGHT messages are tracked, to any nodes.
  *
  * @param dst_address  Dstination node's unicast address
  * @param length Length of message (bytes)
  * @param data_ptr pointer to data buffer that holds message
+ * @return ESP_OK if tracked, ESP_ERR_NO_MEM if too many in flight, ESP_ERR_INVALID_ARG if message too long
  */
-void send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
+esp_err_t send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
+
+// important message in the outbox, reported to host
+typedef struct {
+    uint16_t dst_address;
+    uint16_t seq;
+    uint8_t  retransmits;
+    bool     stored;        // journal in nvs is up to date with this message
+    uint16_t length;        // message length, without sequence
+} mesh_outbox_entry_t;
 
 /**
- * @brief Get the on-tracking Important Message's index
+ * @brief Get the important messages waiting for their ack
+ *
+ *  With MESH_OUTBOX_ENABLED they are journaled in nvs, changes written in batches MESH_OUTBOX_FLUSH_MS after
+ *  the first one, and messages left in the journal are sent again (same sequence) at the end of esp_module_root_init().
  *
- * @param opcode Message or Response opcode of an important message
+ * @param entries Out, one per message
+ * @param max_entries Size of entries
+ * @return Number of entries filled
  */
-int8_t get_important_message_index(uint32_t opcode);
+uint8_t get_outbox_entries(mesh_outbox_entry_t *entries, uint8_t max_entries);
 
 /**
- * @brief Retransmit an Important Message (bytes) to an node
- * 
- *  This function retransmit the important message with higher ttl after timeout for 2 times.
+ * @brief Write pending outbox changes to nvs now instead of waiting for the batch
  *
- * @param ctx_ptr poninter to message context of timeout important message
- * @param opcode Message opcode of an important message
- * @param index Index  of on-tracking Important Message
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the outbox is not journaled, nvs error otherwise
  */
-void retransmit_important_message(esp_ble_mesh_msg_ctx_t* ctx_ptr, uint32_t opcode, int8_t index);
+esp_err_t sync_outbox(void);
 
 /**
- * @brief Clear the tracking on an Important Message
- * 
- *  This function clears the tracking on 1) successful transmission wwith response 2) faild all transmission
- * 
- * @param index Index  of on-tracking Important Message
+ * @brief Drop every important message waiting for its ack and erase the journal
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the outbox is not journaled (messages dropped anyway), nvs error otherwise
+ */
+esp_err_t clear_outbox(void);
+
+/**
+ * @brief Get usage of the preallocated message buffer pools (important messages)
+ *
+ * @param stats Out, one entry per pool, smallest block size first
+ * @param max_pools Entries in stats
+ * @return Number of pools filled
  */
-void clear_important_message(int8_t index);
+uint8_t get_message_pool_stats(mesh_slab_stats_t *stats, uint8_t max_pools);
 
 /**
  * @brief Reset the module and Erase persistent memeory if persistent memeory is enabled.
@@ -115,6 +355,8 @@ void reset_esp32();
  * @param timeout_handler Callback function triggered on timeout on previously sent message without expected response
  * @param broadcast_handler_cb Callback function triggered on reciving incoming broadcase message
  * @param connectivity_handler_cb Callback function triggered on reciving incoming connectivity message (heartbeat connection check)
+ * @param group_status_handler Callback function triggered when a node applied a group subscription change, status is MESH_GROUP_*
+ * @param tx_flow_handler Callback function triggered when the tx queue passes MESH_TX_QUEUE_XOFF (paused) or drains to MESH_TX_QUEUE_XON
  */
 esp_err_t esp_module_root_init(
     void (*prov_complete_handler)(uint16_t node_index, const esp_ble_mesh_octet16_t uuid, uint16_t addr, uint8_t element_num, uint16_t net_idx),
@@ -123,6 +365,8 @@ esp_err_t esp_module_root_init(
     void (*recv_response_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode),
     void (*timeout_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode),
     void (*broadcast_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
-    void (*connectivity_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr));
+    void (*connectivity_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
+    void (*group_status_handler)(uint16_t group_addr, uint16_t node_addr, uint8_t status),
+    void (*tx_flow_handler)(bool paused, uint8_t queued));
 
 #endif /* _BLE_ROOT_H_ */
\ No newline at end of file
@@ -9,37 +9,116 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 #include "iot_button.h"
 #include "board.h"
+#include "uart_tx_ring.h"
 #include "ble_mesh_config_root.h"
 
 #define TAG_B "BOARD"
 #define TAG_W "Debug"
 
-extern void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
 extern void example_ble_mesh_send_remote_provisioning_scan_start(void);
 
-static void uart_init() {  // Uart ===========================================================
+static QueueHandle_t uart_event_queue = NULL;
+static TaskHandle_t uart_tx_task_handle = NULL;
+static uart_tx_ring_t uart_tx_ring;
+static uint32_t uart_tx_ring_storage[UART_TX_RING_SIZE / sizeof(uint32_t)]; // word array keep record headers aligned
+static uint8_t uart_tx_buffer[UART_TX_BUF_SIZE]; // staging buffer for encoded frames, only touched by uart_tx_task
+
+// record types in uart_tx_ring, processed strictly in enqueue order
+#define UART_TX_RECORD_FRAME        0x01 // | 2 byte node addr (host order) | payload |
+#define UART_TX_RECORD_LINK_CONFIG  0x02 // uart_tx_link_config_t
+#define UART_TX_RECORD_LINK_MODE    0x03 // | mode |
+
+static uint8_t uart_tx_link_mode = UART_LINK_MODE_PLAIN; // framing of frames sent to host, only touched by uart_tx_task
+static uint8_t uart_tx_seq = 0;
+
+// host link setting, previous one is kept until host confirm the new baud rate
+static uint32_t uart_baud_rate = UART_BAUD_RATE;
+static bool uart_hw_flow_ctrl = false;
+static uint32_t uart_prev_baud_rate = UART_BAUD_RATE;
+static bool uart_prev_hw_flow_ctrl = false;
+static bool uart_baud_pending = false;
+static portMUX_TYPE uart_link_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t uart_baud_confirm_timer = NULL;
+
+// framing of frames received from host, only touched by rx task
+static uint8_t uart_rx_link_mode = UART_LINK_MODE_PLAIN;
+static uint8_t uart_rx_seq_base = 0;    // next expected seq
+static bool uart_rx_seq_nacked = false; // gap reported for this base, later frames ahead of it are only acked
+
+typedef struct {
+    uint32_t baud_rate;
+    bool hw_flow_ctrl;
+    bool start_confirm_timer; // switch wait for host confirm, timer starts once the new setting is applied
+} uart_tx_link_config_t;
+
+static void uart_baud_confirm_timeout(void* arg);
+static void uart_tx_task(void* arg);
+
+static int uart_transport_write(void* ctx, const uint8_t* data, size_t length) {
+    return uart_write_bytes(UART_NUM, data, length);
+}
+
+static int uart_transport_read(void* ctx, uint8_t* data, size_t length, uint32_t timeout_ms) {
+    return uart_read_bytes(UART_NUM, data, length, pdMS_TO_TICKS(timeout_ms));
+}
+
+static const uart_transport_t uart_transport = {
+    .write = uart_transport_write,
+    .read = uart_transport_read,
+    .ctx = NULL,
+};
+
+static void uart_init(uint32_t baud_rate, bool hw_flow_ctrl) {  // Uart ===========================================================
     const int uart_num = UART_NUM;
     const int uart_buffer_size = UART_BUF_SIZE * 2;
+
+    if (hw_flow_ctrl && !UART_HW_FLOW_CTRL_WIRED) {
+        ESP_LOGW(TAG_B, "RTS/CTS pins not wired, hardware flow control disabled");
+        hw_flow_ctrl = false;
+    }
+
     uart_config_t uart_config = {
-        .baud_rate = UART_BAUD_RATE,
+        .baud_rate = baud_rate,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl= UART_HW_FLOWCTRL_DISABLE, // = UART_HW_FLOWCTRL_CTS_RTS,
-        .rx_flow_ctrl_thresh = UART_SCLK_DEFAULT, // = 122,
+        .flow_ctrl = (hw_flow_ctrl ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE),
+        .rx_flow_ctrl_thresh = UART_RX_FLOW_CTRL_THRESH,
+        .source_clk = UART_SCLK_DEFAULT,
     };
+    uart_baud_rate = uart_prev_baud_rate = baud_rate;
+    uart_hw_flow_ctrl = uart_prev_hw_flow_ctrl = hw_flow_ctrl;
 
     ESP_ERROR_CHECK(uart_driver_install(uart_num, uart_buffer_size,
-                                        uart_buffer_size, 0, NULL, 0)); // not using queue
-                                        // uart_buffer_size, 20, &uart_queue, 0));
+                                        uart_buffer_size, UART_EVENT_QUEUE_SIZE, &uart_event_queue, 0));
     // Configure UART parameters
     ESP_ERROR_CHECK(uart_param_config(uart_num, &uart_config));
     // Set UART pins                      (TX,      RX,      RTS,     CTS)
     ESP_ERROR_CHECK(uart_set_pin(uart_num, TXD_PIN, RXD_PIN, RTS_PIN, CTS_PIN));
 
+    // raise UART_PATTERN_DET event on every end byte, 0xFE never shows up inside an encoded frame
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(uart_num, UART_END, 1, 9, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(uart_num, UART_EVENT_QUEUE_SIZE));
+
+    const esp_timer_create_args_t confirm_timer_args = {
+        .callback = uart_baud_confirm_timeout,
+        .name = "uart_baud_confirm",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&confirm_timer_args, &uart_baud_confirm_timer));
+
+    // single owner of the uart tx, mesh callbacks only enqueue and never wait on the wire
+    uart_tx_ring_init(&uart_tx_ring, (uint8_t*) uart_tx_ring_storage, sizeof(uart_tx_ring_storage));
+    if (xTaskCreate(uart_tx_task, "uart_tx_task", 1024 * 3, NULL, configMAX_PRIORITIES - 2, &uart_tx_task_handle) != pdPASS) {
+        ESP_LOGE(TAG_B, "Failed to create uart tx task");
+    }
+
     ESP_LOGI(TAG_B, "Uart init done");
 }
 
@@ -88,93 +167,347 @@ static void board_button_init(void)
     }
 }
 
-// escape char
-int uart_write_encoded_bytes(uart_port_t uart_num, uint8_t* data, size_t length) {
-    uint8_t esacpe_byte = ESCAPE_BYTE;
+// enqueue a record for uart_tx_task, cost to the caller is a memcpy regardless of the wire speed
+static int uart_tx_enqueue(uint8_t type, const uint8_t* head, size_t head_length, const uint8_t* data, size_t length) {
+    if (uart_tx_task_handle == NULL) {
+        ESP_LOGE(TAG_B, "Uart not initialized, drop %d bytes", length);
+        return -1;
+    }
 
-    int byte_wrote = 0;
-    for (uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
-        if (byte_itr[0] < esacpe_byte) {
-            uart_write_bytes(UART_NUM, byte_itr, 1);
-            byte_wrote += 1;
-            continue;
-        }
+    uint8_t* record = uart_tx_ring_reserve(&uart_tx_ring, head_length + length, type);
+    if (record == NULL) {
+        ESP_LOGW(TAG_B, "Uart tx ring full, drop %d bytes", length);
+        return -1;
+    }
+
+    if (head_length > 0) {
+        memcpy(record, head, head_length);
+    }
+    memcpy(record + head_length, data, length);
+    uart_tx_ring_commit(&uart_tx_ring, record);
+    xTaskNotifyGive(uart_tx_task_handle);
+    return length;
+}
+
+int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length)
+{
+    if (length > UART_BUF_SIZE) {
+        ESP_LOGE("[UART]", "Data too long (%d bytes) for uart-tx", length);
+        return -1;
+    }
 
-        // nned 2 byte encoded
-        uint8_t encoded = byte_itr[0] ^ esacpe_byte; // bitwise Xor
-        uart_write_bytes(UART_NUM, &esacpe_byte, 1);
-        uart_write_bytes(UART_NUM, &encoded, 1);
-        byte_wrote += 2;
+    // frame is encoded by uart_tx_task, producer only copy the raw address and payload
+    int queued = uart_tx_enqueue(UART_TX_RECORD_FRAME, (uint8_t*) &node_addr, sizeof(node_addr), data, length);
+    if (queued < 0) {
+        ESP_LOGE("[UART]", "Failed to queue %d bytes Data to node-%d on uart-tx", length, node_addr);
     }
+    return queued;
+}
+
+int uart_sendMsg(uint16_t node_addr, char* msg)
+{
+    return uart_sendData(node_addr, (uint8_t*) msg, strlen(msg));
+}
+
+// ======================== Host Link Baud Rate Negotiation ========================
+static void uart_send_link_status(uint8_t status, uint32_t baud_rate, bool hw_flow_ctrl) {
+    uint8_t buffer[7];
+    uint32_t baud_rate_network_endian = htonl(baud_rate);
 
-    return byte_wrote;
+    buffer[0] = UART_MSG_LINK_STATUS;
+    buffer[1] = status;
+    memcpy(buffer + 2, &baud_rate_network_endian, 4);
+    buffer[6] = (hw_flow_ctrl ? UART_LINK_FLAG_HW_FLOW_CTRL : 0);
+    uart_sendData(0, buffer, sizeof(buffer));
 }
 
-// Able to wrote back to the same buffer, since decoded data is always shorter
-int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data) {
-    int decoed_len = 0;
-    uint8_t* decode_itr = decoded_data;
+// queued behind every frame enqueued before, uart_tx_task applies it once those are written on the old setting
+static int uart_queue_link_config(uint32_t baud_rate, bool hw_flow_ctrl, bool start_confirm_timer) {
+    uart_tx_link_config_t config = {
+        .baud_rate = baud_rate,
+        .hw_flow_ctrl = hw_flow_ctrl,
+        .start_confirm_timer = start_confirm_timer,
+    };
+
+    if (uart_tx_enqueue(UART_TX_RECORD_LINK_CONFIG, NULL, 0, (uint8_t*) &config, sizeof(config)) < 0) {
+        return -1;
+    }
+
+    uart_baud_rate = baud_rate;
+    uart_hw_flow_ctrl = hw_flow_ctrl;
+    return 0;
+}
 
-    for (uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
-        if (byte_itr[0] != ESCAPE_BYTE) {
-            // not a ESCAPE_BYTE
-            decode_itr[0] = byte_itr[0];
-            decode_itr += 1;
-            decoed_len += 1;
-            continue;
+static void uart_apply_link_config(const uart_tx_link_config_t* config) {
+    // let pending bytes go out on the old setting first
+    uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(UART_BAUD_CONFIRM_TIMEOUT_MS));
+    uart_set_baudrate(UART_NUM, config->baud_rate);
+    uart_set_hw_flow_ctrl(UART_NUM, (config->hw_flow_ctrl ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE), UART_RX_FLOW_CTRL_THRESH);
+    uart_flush_input(UART_NUM); // drop garbage received during the switch
+
+    if (config->start_confirm_timer) {
+        esp_timer_start_once(uart_baud_confirm_timer, UART_BAUD_CONFIRM_TIMEOUT_MS * 1000);
+    }
+    ESP_LOGI(TAG_B, "Uart link switched to %" PRIu32 " baud, flow control %s", config->baud_rate, config->hw_flow_ctrl ? "on" : "off");
+}
+
+// take the pending switch, only one of confirm and timeout get to handle it
+static bool uart_take_baud_pending(void) {
+    bool pending;
+    portENTER_CRITICAL(&uart_link_lock);
+    pending = uart_baud_pending;
+    uart_baud_pending = false;
+    portEXIT_CRITICAL(&uart_link_lock);
+    return pending;
+}
+
+static void uart_baud_confirm_timeout(void* arg) {
+    if (!uart_take_baud_pending()) {
+        return;
+    }
+
+    ESP_LOGW(TAG_B, "No confirm on %" PRIu32 " baud, fall back to %" PRIu32, uart_baud_rate, uart_prev_baud_rate);
+    uart_queue_link_config(uart_prev_baud_rate, uart_prev_hw_flow_ctrl, false);
+    uart_send_link_status(UART_LINK_FALLBACK, uart_baud_rate, uart_hw_flow_ctrl);
+}
+
+int uart_link_request_baud_rate(uint32_t baud_rate, bool hw_flow_ctrl) {
+    static const uint32_t supported_baud_rates[] = UART_SUPPORTED_BAUD_RATES;
+    bool supported = false;
+
+    for (int i = 0; i < sizeof(supported_baud_rates) / sizeof(supported_baud_rates[0]); i++) {
+        if (supported_baud_rates[i] == baud_rate) {
+            supported = true;
+            break;
         }
+    }
 
-        // ESCAPE_BYTE, decode 2 byte into 1
-        byte_itr += 1; // move to next to get encoded byte
-        uint8_t encoded = byte_itr[0];
-        
-        uint8_t decoded = encoded ^ ESCAPE_BYTE; // bitwise Xor
-        decode_itr[0] = decoded;
-        decode_itr += 1;
-        decoed_len += 1;
+    // claim the switch under the lock the confirm path takes it with, a second request sees it pending
+    bool busy;
+    portENTER_CRITICAL(&uart_link_lock);
+    busy = uart_baud_pending;
+    if (supported && !(hw_flow_ctrl && !UART_HW_FLOW_CTRL_WIRED) && !busy) {
+        uart_baud_pending = true;
     }
-    
-    return decoed_len;
+    portEXIT_CRITICAL(&uart_link_lock);
+
+    if (!supported || (hw_flow_ctrl && !UART_HW_FLOW_CTRL_WIRED) || busy) {
+        ESP_LOGW(TAG_B, "Rejected baud rate %" PRIu32 ", flow control %d", baud_rate, hw_flow_ctrl);
+        uart_send_link_status(UART_LINK_REJECTED, baud_rate, hw_flow_ctrl);
+        return UART_LINK_REJECTED;
+    }
+
+    // acknowledge on current setting, then switch and wait for host confirm on the new one
+    uart_send_link_status(UART_LINK_SWITCHING, baud_rate, hw_flow_ctrl);
+    uart_prev_baud_rate = uart_baud_rate;
+    uart_prev_hw_flow_ctrl = uart_hw_flow_ctrl;
+    if (uart_queue_link_config(baud_rate, hw_flow_ctrl, true) < 0) {
+        uart_take_baud_pending();
+        uart_send_link_status(UART_LINK_REJECTED, baud_rate, hw_flow_ctrl);
+        return UART_LINK_REJECTED;
+    }
+    return UART_LINK_SWITCHING;
 }
 
-// TB Finish, need to encode the send data for escape bytes
-// do we need to regulate the message length?
-int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length)
-{
-    uint8_t uart_start = UART_START;
-    uint8_t uart_end = UART_END;
-    int txBytes = 0;
+int uart_link_confirm_baud_rate(void) {
+    if (!uart_take_baud_pending()) {
+        // nothing pending or already fallen back, report current setting
+        uart_send_link_status(UART_LINK_REJECTED, uart_baud_rate, uart_hw_flow_ctrl);
+        return UART_LINK_REJECTED;
+    }
 
-    uint16_t node_addr_network_endian = htons(node_addr); 
-    txBytes += uart_write_bytes(UART_NUM, &uart_start, 1); // 0xFF
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) &node_addr_network_endian, 2);
-    txBytes += uart_write_encoded_bytes(UART_NUM, data, length);
-    txBytes += uart_write_bytes(UART_NUM, &uart_end, 1);  // 0xFE
+    esp_timer_stop(uart_baud_confirm_timer);
+    uart_prev_baud_rate = uart_baud_rate;
+    uart_prev_hw_flow_ctrl = uart_hw_flow_ctrl;
+    uart_send_link_status(UART_LINK_CONFIRMED, uart_baud_rate, uart_hw_flow_ctrl);
+    return UART_LINK_CONFIRMED;
+}
+
+// ======================== UART TX Writer ========================
+static void uart_tx_flush(size_t* staged) {
+    if (*staged == 0) {
+        return;
+    }
 
-    ESP_LOGI("[UART]", "Wrote %d bytes Data on uart-tx", txBytes);
-    return txBytes;
+    int txBytes = uart_transport.write(uart_transport.ctx, uart_tx_buffer, *staged);
+    if (txBytes < 0) {
+        ESP_LOGE("[UART]", "Failed to write %d bytes Data on uart-tx", *staged);
+    } else {
+        ESP_LOGI("[UART]", "Wrote %d bytes Data on uart-tx", txBytes);
+    }
+    *staged = 0;
 }
 
-// TB Finish, need to encode the send data for escape bytes
-int uart_sendMsg(uint16_t node_addr, char* msg)
+// drain every committed record, frames are encoded back to back into the staging buffer
+// and handed to the driver in as few writes as possible
+static void uart_tx_drain(void) {
+    const uint8_t* record;
+    uint16_t length;
+    uint8_t type;
+    size_t staged = 0;
+
+    while ((record = uart_tx_ring_peek(&uart_tx_ring, &length, &type)) != NULL) {
+        if (type == UART_TX_RECORD_FRAME) {
+            uint16_t node_addr;
+            size_t payload_len = length - sizeof(node_addr);
+            memcpy(&node_addr, record, sizeof(node_addr));
+
+            const uint8_t* payload = record + sizeof(node_addr);
+            size_t trailer_len = ((uart_tx_link_mode & UART_LINK_MODE_SEQ) ? UART_SEQ_TRAILER_LEN : 0);
+
+            size_t frame_max_len = ((uart_tx_link_mode & UART_LINK_MODE_COBS) ?
+                                    UART_COBS_FRAME_MAX_LEN(sizeof(node_addr) + payload_len + trailer_len) :
+                                    UART_FRAME_MAX_LEN(payload_len + trailer_len));
+            if (staged + frame_max_len > sizeof(uart_tx_buffer)) {
+                uart_tx_flush(&staged);
+            }
+
+            uint8_t* frame = uart_tx_buffer + staged;
+            size_t frame_size = sizeof(uart_tx_buffer) - staged;
+            if (uart_tx_link_mode & UART_LINK_MODE_COBS) {
+                uint8_t trailer[UART_SEQ_TRAILER_LEN];
+                if (trailer_len > 0) {
+                    uart_seq_trailer(node_addr, uart_tx_seq++, payload, payload_len, trailer);
+                }
+                staged += uart_encode_cobs_frame(node_addr, payload, payload_len, trailer, trailer_len, frame, frame_size);
+            } else if (trailer_len > 0) {
+                staged += uart_encode_seq_frame(node_addr, uart_tx_seq++, payload, payload_len, frame, frame_size);
+            } else {
+                staged += uart_encode_frame(node_addr, payload, payload_len, frame, frame_size);
+            }
+        } else if (type == UART_TX_RECORD_LINK_CONFIG) {
+            uart_tx_link_config_t config;
+            memcpy(&config, record, sizeof(config));
+
+            uart_tx_flush(&staged);
+            uart_apply_link_config(&config);
+        } else if (type == UART_TX_RECORD_LINK_MODE) {
+            uart_tx_link_mode = record[0];
+            uart_tx_seq = 0;
+        }
+        uart_tx_ring_release(&uart_tx_ring);
+    }
+
+    uart_tx_flush(&staged);
+}
+
+static void uart_tx_task(void* arg)
 {
-    size_t length = strlen(msg);
-    uint8_t uart_start = UART_START;
-    uint8_t uart_end = UART_END;
-    int txBytes = 0;
+    while (1) {
+        // every producer notifies after commit, a record committed while draining leaves the count non zero
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uart_tx_drain();
+    }
+}
+
+// ======================== Host Link Framing Mode ========================
+static void uart_send_link_ack(uint8_t type) {
+    uint8_t buffer[3];
+    buffer[0] = type;
+    buffer[1] = uart_rx_seq_base;
+    buffer[2] = 0; // no frame ahead of the base is kept
+    uart_sendData(0, buffer, sizeof(buffer));
+}
+
+int uart_link_set_mode(uint8_t mode) {
+    uint8_t buffer[3];
+    buffer[0] = UART_MSG_LINK_MODE;
+    buffer[2] = mode;
 
-    uint16_t node_addr_big_endian = htons(node_addr); 
-    txBytes += uart_write_bytes(UART_NUM, &uart_start, 1); // 0xFF
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) &node_addr_big_endian, 2);
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) msg, length);
-    txBytes += uart_write_bytes(UART_NUM, &uart_end, 1);  // 0xFE
+    if (mode & ~UART_LINK_MODES_SUPPORTED) {
+        ESP_LOGW(TAG_B, "Rejected link mode 0x%02x", mode);
+        buffer[1] = UART_LINK_REJECTED;
+        uart_sendData(0, buffer, sizeof(buffer));
+        return UART_LINK_REJECTED;
+    }
+
+    // reply on current mode, uart_tx_task switch after it
+    buffer[1] = UART_LINK_CONFIRMED;
+    uart_sendData(0, buffer, sizeof(buffer));
+    uart_tx_enqueue(UART_TX_RECORD_LINK_MODE, NULL, 0, &mode, sizeof(mode));
+
+    uart_rx_link_mode = mode;
+    uart_rx_seq_base = 0;
+    uart_rx_seq_nacked = false;
+    ESP_LOGI(TAG_B, "Uart link mode 0x%02x", mode);
+    return UART_LINK_CONFIRMED;
+}
+
+uint8_t uart_link_get_rx_mode(void) {
+    return uart_rx_link_mode;
+}
+
+bool uart_link_accept_frame(const uint8_t* frame, size_t* length, bool can_deliver) {
+    if (!(uart_rx_link_mode & UART_LINK_MODE_SEQ)) {
+        return true;
+    }
+
+    if (*length <= UART_SEQ_TRAILER_LEN) {
+        ESP_LOGW(TAG_B, "Frame with %d bytes too short for seq trailer", *length);
+        uart_send_link_ack(UART_MSG_NACK);
+        return false;
+    }
 
-    ESP_LOGI("[UART]", "Wrote %d bytes Msg on uart-tx", txBytes);
-    return txBytes;
+    size_t content_len = *length - UART_SEQ_TRAILER_LEN;
+    uint8_t seq = frame[content_len];
+    uint16_t crc = (frame[content_len + 1] << 8) | frame[content_len + 2];
+    if (uart_crc16(frame, content_len + 1, UART_CRC16_INIT) != crc) {
+        // seq itself can't be trusted, NACK carry the window so host resends whatever is missing
+        ESP_LOGW(TAG_B, "Frame crc mismatch, expected seq %d", uart_rx_seq_base);
+        uart_send_link_ack(UART_MSG_NACK);
+        return false;
+    }
+
+    // go-back-N, commands run in seq order only, a frame ahead of the base means one got lost and is dropped,
+    // the first one of a gap is nacked so host resends from the base right away
+    uint8_t offset = seq - uart_rx_seq_base; // wrap around on 8 bit
+    if (offset != 0) {
+        if (offset < UART_SEQ_WINDOW && !uart_rx_seq_nacked) {
+            ESP_LOGW(TAG_B, "Frame seq %d ahead, expected seq %d", seq, uart_rx_seq_base);
+            uart_rx_seq_nacked = true;
+            uart_send_link_ack(UART_MSG_NACK);
+            return false;
+        }
+        if (offset >= UART_SEQ_WINDOW && offset < 256 - UART_SEQ_WINDOW) {
+            ESP_LOGW(TAG_B, "Frame seq %d out of window, expected seq %d", seq, uart_rx_seq_base);
+        }
+        // gap already nacked, or behind the window (duplicate of an accepted frame whose ack got lost), just ack
+        uart_send_link_ack(UART_MSG_ACK);
+        return false;
+    }
+
+    if (!can_deliver) {
+        // no room to run it, seq stays expected so host resends it instead of losing the command
+        ESP_LOGW(TAG_B, "No command buffer for seq %d", seq);
+        uart_send_link_ack(UART_MSG_NACK);
+        return false;
+    }
+
+    uart_rx_seq_base++;
+    uart_rx_seq_nacked = false;
+    uart_send_link_ack(UART_MSG_ACK);
+    *length = content_len;
+    return true;
+}
+
+void uart_link_report_rx_error(void) {
+    if (uart_rx_link_mode & UART_LINK_MODE_SEQ) {
+        uart_send_link_ack(UART_MSG_NACK);
+    }
+}
+
+const uart_transport_t* uart_get_transport(void)
+{
+    return &uart_transport;
+}
+
+QueueHandle_t uart_get_event_queue(void)
+{
+    return uart_event_queue;
 }
 
 void board_init(void)
 {
-    uart_init();
+    uart_init(UART_BAUD_RATE, UART_HW_FLOW_CTRL);
     board_button_init();
 }
\ No newline at end of file
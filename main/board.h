@@ -11,6 +11,8 @@
 #include "driver/gpio.h"
 #include <arpa/inet.h>
 #include "../Secret/NetworkConfig.h"
+#include "uart_codec.h"
+#include "uart_transport.h"
 
 #ifndef _BOARD_H_
 #define _BOARD_H_
@@ -56,44 +58,167 @@
 #define RXD_PIN     RX_PIN_H2
 #define RTS_PIN     UART_PIN_NO_CHANGE // not using
 #define CTS_PIN     UART_PIN_NO_CHANGE // not using
-#define UART_BAUD_RATE 115200
+#define UART_BAUD_RATE 115200 // boot baud rate, host can negotiate a higher one with BAUD- command
 #define UART_BUF_SIZE 1024
+#define UART_EVENT_QUEUE_SIZE 20
+
+#define UART_HW_FLOW_CTRL false // RTS/CTS at boot, need RTS_PIN and CTS_PIN wired
+#define UART_HW_FLOW_CTRL_WIRED (RTS_PIN != UART_PIN_NO_CHANGE && CTS_PIN != UART_PIN_NO_CHANGE)
+#define UART_RX_FLOW_CTRL_THRESH 122
+#define UART_BAUD_CONFIRM_TIMEOUT_MS 2000 // host must confirm new baud rate in time, or root fall back
+#define UART_SUPPORTED_BAUD_RATES { 115200, 230400, 460800, 921600, 1000000, 2000000 }
 
 #define BUTTON_IO_NUM           9
 #define BUTTON_ACTIVE_LEVEL     0
-#define ESCAPE_BYTE 0xFA
-#define UART_START 0xFF
-#define UART_END 0xFE
+
+#define UART_TX_BUF_SIZE UART_FRAME_MAX_LEN(UART_BUF_SIZE + UART_SEQ_TRAILER_LEN)
+#define UART_TX_RING_SIZE 4096 // queued tx records waiting for the writer task, power of 2
+#define UART_CMD_POOL_SIZE 8 // decoded host commands waiting for the dispatch task
+#define UART_CMD_DISPATCH_PRIORITY 5 // dispatch task runs mesh calls, keep it below the bluetooth tasks
+
+// first payload byte of root status frames (node address 0)
+#define UART_MSG_NET_INFO       0x01
+#define UART_MSG_NODE_INFO      0x02
+#define UART_MSG_ROOT_ONLINE    0x03
+#define UART_MSG_LINK_STATUS    0x04 // | status | 4 byte baud rate | flags |
+#define UART_MSG_LINK_MODE      0x05 // | status | mode |
+#define UART_MSG_ACK            0x06 // | next expected seq | 0 |, every frame before next expected seq received
+#define UART_MSG_NACK           0x07 // | next expected seq | 0 |, sent on corrupted or lost host frame, resend from next expected
+#define UART_MSG_MULTI_SEND     0x08 // | node count | node count * (2 byte node addr | result) |, MSEND summary
+#define UART_MSG_GROUP_STATUS   0x09 // | 2 byte group addr | 2 byte node addr | status |, subscription change applied
+#define UART_MSG_NET_DELTA      0x0A // | 4 byte epoch | 4 byte version | flags | node amount | node amount * (state | 2 byte node addr | 16 byte uuid) |
+
+// flags in UART_MSG_NET_DELTA frame
+#define UART_NET_DELTA_MORE     0x01 // more frames of the same reply follow
+#define UART_NET_DELTA_FULL     0x02 // whole node table, host version unknown or too old, host drops its own table
+
+// node state in UART_MSG_NET_DELTA frame
+#define UART_NODE_PROVISIONED   0x00
+#define UART_NODE_CONFIGURED    0x01
+#define UART_NODE_REMOVED       0x02
+
+#define UART_MSG_NODE_QUERY     0x0B // | 2 byte next cursor | 2 byte field mask | node amount | node amount * record |
+
+// field mask in NQURY command and UART_MSG_NODE_QUERY frame, record is | 2 byte node addr | selected fields in bit order |
+#define UART_NODE_FIELD_UUID        0x0001 // 16 byte uuid
+#define UART_NODE_FIELD_STATE       0x0002 // UART_NODE_* state
+#define UART_NODE_FIELD_VERSION     0x0004 // 4 byte topology version of the last change
+#define UART_NODE_FIELD_LAST_SEEN   0x0008 // 4 byte ms since last message, 0xFFFFFFFF if never heard
+#define UART_NODE_FIELD_LINK        0x0010 // rssi (signed) | remaining ttl of the last message
+#define UART_NODE_FIELD_COMPOSITION 0x0020 // element amount | per element (sig amount | vnd amount | 2 byte sig ids | 4 byte vnd ids)
+#define UART_NODE_FIELD_TTL         0x0040 // learned hops (0xFF unknown) | ttl used for unicast | host override (0xFF none)
+#define UART_NODE_FIELD_RTT         0x0080 // 4 byte smoothed rtt us (0 no sample) | 4 byte rtt variation us | 4 byte timeout ms (0 stack default)
+#define UART_NODE_QUERY_END         0xFFFF // next cursor when every node was sent
+
+#define UART_MSG_SEND_STATUS    0x0C // | 2 byte request id | 2 byte node addr | status | 4 byte latency us |, SENDT outcome
+#define UART_MSG_TX_FLOW        0x0D // | state | queued sends | queue size |, mesh tx queue crossed a watermark
+#define UART_MSG_TRANSFER       0x0E // | status | 2 byte node addr | 4 byte offset |, XOPEN/XDATA progress (MESH_XFER_* status)
+#define UART_MSG_POOL_STATS     0x0F // | pool amount | pool amount * (2 byte block size | 2 byte blocks | 2 byte in use | 2 byte high water | 4 byte failures) |
+#define UART_MSG_OUTBOX         0x10 // | status | entry amount | entry amount * (2 byte node addr | 2 byte seq | retransmits | stored | 2 byte length) |
+
+// state in UART_MSG_TX_FLOW frame
+#define UART_TX_XON             0x00 // queue drained to MESH_TX_QUEUE_XON, host may send again
+#define UART_TX_XOFF            0x01 // queue reached MESH_TX_QUEUE_XOFF, host should hold SEND-/BCAST until XON
+
+// status in UART_MSG_OUTBOX frame, result of the OUTBX action
+#define UART_OUTBOX_OK          0x00
+#define UART_OUTBOX_NO_JOURNAL  0x01 // MESH_OUTBOX_ENABLED off or nvs not opened, messages kept in ram only
+#define UART_OUTBOX_NVS_ERROR   0x02 // some changes not written, retried with the next batch
+
+// status in UART_MSG_LINK_STATUS frame
+#define UART_LINK_SWITCHING     0x00 // accepted, root switched and wait for host confirm on new baud rate
+#define UART_LINK_CONFIRMED     0x01
+#define UART_LINK_REJECTED      0x02
+#define UART_LINK_FALLBACK      0x03 // no confirm in time, root reverted to previous baud rate
+
+// framing mode on the host link, set by host with LINK- command
+#define UART_LINK_MODES_SUPPORTED (UART_LINK_MODE_SEQ | UART_LINK_MODE_COBS)
+
+#define UART_SEQ_WINDOW 8       // host frames in flight, seq within next expected + UART_SEQ_WINDOW - 1
 
 void board_init(void);
 
 /**
- * @brief Encoded bytes and write to a UART port.
+ * @brief Get the uart driver event queue, frame ends are reported as UART_PATTERN_DET events.
+ * 
+ * @return Event queue handle, NULL before board_init().
+ */
+QueueHandle_t uart_get_event_queue(void);
+
+/**
+ * @brief Get the transport on the host link uart, raw bytes without framing.
+ * 
+ * @return Transport, writes are only done by the uart tx task.
+ */
+const uart_transport_t* uart_get_transport(void);
+
+/**
+ * @brief Request a new baud rate (and flow control mode) on the host link.
+ * 
+ *  Root acknowledges with UART_LINK_SWITCHING on the current baud rate, then switches and waits
+ *  UART_BAUD_CONFIRM_TIMEOUT_MS for uart_link_confirm_baud_rate(), otherwise falls back to the previous setting.
  * 
- * @param uart_num UART port number.
- * @param data Pointer to the data to be written.
- * @param length Length of the data.
- * @return Status of the write operation.
+ * @param baud_rate Requested baud rate, must be in UART_SUPPORTED_BAUD_RATES.
+ * @param hw_flow_ctrl Enable RTS/CTS hardware flow control, only allowed when the pins are wired.
+ * @return Link status sent to host.
  */
-int uart_write_encoded_bytes(uart_port_t uart_num, uint8_t* data, size_t length);
+int uart_link_request_baud_rate(uint32_t baud_rate, bool hw_flow_ctrl);
 
 /**
- * @brief Decode bytes from the provided data.
+ * @brief Confirm the pending baud rate after host received the switch frame and switched itself.
  * 
- * @param data Pointer to the encoded data.
- * @param length Length of the encoded data.
- * @param decoded_data Pointer to the buffer for the decoded data.
- * @return Status of the decode operation.
+ * @return Link status sent to host.
  */
-int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data);
+int uart_link_confirm_baud_rate(void);
+
+/**
+ * @brief Set the framing mode on the host link.
+ * 
+ *  Root replies UART_MSG_LINK_MODE on the current mode, frames received after this call and frames sent
+ *  after the reply use the new mode. Sequence numbers restart from 0 on both directions.
+ * 
+ * @param mode UART_LINK_MODE_PLAIN or combination of UART_LINK_MODES_SUPPORTED.
+ * @return Link status sent to host.
+ */
+int uart_link_set_mode(uint8_t mode);
+
+/**
+ * @brief Get the framing mode expected on frames from host.
+ * 
+ * @return Link mode.
+ */
+uint8_t uart_link_get_rx_mode(void);
+
+/**
+ * @brief Check a decoded host frame against the link mode, called by rx task for every frame.
+ * 
+ *  In UART_LINK_MODE_SEQ the crc is verified and the frame is acked (UART_MSG_ACK) or nacked (UART_MSG_NACK),
+ *  duplicates of already accepted frames are acked again but not delivered. Only the frame with the next expected
+ *  seq is delivered, so commands run in seq order, frames ahead of it are dropped and host resends them (go-back-N).
+ *  A frame the caller has no room for is nacked and its seq stays expected.
+ * 
+ * @param frame Pointer to the decoded frame.
+ * @param length In/Out, frame length, trimmed to the command length when accepted.
+ * @param can_deliver false if the caller could not run or queue the command now.
+ * @return true if the command in the frame should be executed.
+ */
+bool uart_link_accept_frame(const uint8_t* frame, size_t* length, bool can_deliver);
+
+/**
+ * @brief Report lost host bytes (rx overflow), sends UART_MSG_NACK so host retransmits without waiting for timeout.
+ */
+void uart_link_report_rx_error(void);
 
 /**
  * @brief Send data to a specific node address over UART.
  * 
+ *  Data is copied into the tx ring and written by the uart tx task, safe to call from any task
+ *  and never blocks on the uart.
+ * 
  * @param node_addr Node address to send the data to.
  * @param data Pointer to the data to be sent.
- * @param length Length of the data.
- * @return Status of the send operation.
+ * @param length Length of the data, at most UART_BUF_SIZE.
+ * @return Number of bytes queued, -1 if uart is not initialized or the tx ring is full.
  */
 int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length);
 
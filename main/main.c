@@ -1,22 +1,28 @@
 #include "board.h"
 #include "ble_mesh_config_root.h"
+#include "uart_codec_bench.h"
+#include "uart_command.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <arpa/inet.h> // for host byte endianess <--> network byte endianess convert
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
 
 #define TAG_M "MAIN"
 #define TAG_ALL "*"
 #define OPCODE_LEN 1
 #define NODE_ADDR_LEN 2  // can't change bc is base on esp
 #define NODE_UUID_LEN 16 // can't change bc is base on esp
-#define CMD_LEN 5 // network command length - 5 byte
-#define CMD_GET_NET_INFO "NINFO"
-#define CMD_SEND_MSG "SEND-"
-#define CMD_BROADCAST_MSG "BCAST"
-#define CMD_RESET_ROOT "RST-R"
-#define CMD_CLEAN_NETWORK_CONFIG "CLEAN"
+#define NET_INFO_BATCH 40 // nodes per network info frame, keeps a frame within UART_BUF_SIZE
+#define NET_DELTA_HEADER_LEN (OPCODE_LEN + 4 + 4 + 1 + 1) // opcode, epoch, version, flags, node amount
+#define NET_DELTA_NODE_LEN (1 + NODE_ADDR_LEN + NODE_UUID_LEN) // state, node_addr, node_uuid
+#define NODE_QUERY_HEADER_LEN (OPCODE_LEN + 2 + 2 + 1) // opcode, next cursor, field mask, node amount
+
+#if CMD_MAX_MULTI_SEND_ADDRS > MESH_FANOUT_MAX_DST
+#error "MSEND accepts more node addresses than the fan-out can hold"
+#endif
 
 /***************** Event Handler *****************/
 // prov_complete_handler() get triger when a new node is provitioned to the network
@@ -30,16 +36,13 @@ static void config_complete_handler(uint16_t node_addr) {
     ESP_LOGI(TAG_M,  " ----------- Node-0x%04x config_complete -----------", node_addr);
     uart_sendMsg(node_addr, " ----------- config_complete -----------\n");
     // 16 byte uuid on node
-    uint8_t node_data_size = NODE_ADDR_LEN + NODE_UUID_LEN; // node_addr + node_uuid size
-    uint8_t buffer_size = OPCODE_LEN + node_data_size; // 1 byte opcode, 16 byte node_uuid
-    uint8_t* buffer = (uint8_t*) malloc(buffer_size * sizeof(uint8_t));
+    uint8_t buffer[OPCODE_LEN + NODE_UUID_LEN]; // 1 byte opcode, 16 byte node_uuid
 
-    buffer[0] = 0x02; // node info
+    buffer[0] = UART_MSG_NODE_INFO; // node info
     uint8_t* buffer_itr = buffer + OPCODE_LEN;
     esp_ble_mesh_node_t *node_ptr = esp_ble_mesh_provisioner_get_node_with_addr(node_addr);
     if (node_ptr == NULL) {
         uart_sendMsg(node_addr, "Error, can get node that's just configed");
-        free(buffer);
         return;
     }
 
@@ -48,7 +51,6 @@ static void config_complete_handler(uint16_t node_addr) {
     buffer_itr += NODE_UUID_LEN;
 
     uart_sendData(node_addr, buffer, buffer_itr-buffer);
-    free(buffer);
     printNetworkInfo(); // esp log for debug
 }
 
@@ -62,8 +64,8 @@ static void recv_message_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
     uart_sendData(node_addr, msg_ptr, length);
 
     // check if needs an response to confirm recived
-    if (opcode == ECS_193_MODEL_OP_MESSAGE) {
-        // only normal message no need for response
+    if (opcode == ECS_193_MODEL_OP_MESSAGE || opcode == ECS_193_MODEL_OP_MESSAGE_I) {
+        // only normal message no need for response, sequenced important message acked by root module
         return;
     }
 
@@ -95,26 +97,13 @@ static void recv_message_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
 static void recv_response_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
     // ESP_LOGI(TAG_M, " ----------- recv_response handler trigered -----------");
     ESP_LOGW(TAG_M, "-> Recived Response \'%s\'", (char*)msg_ptr);
-    
-    // clear confirmed recived important message
-    int8_t index = get_important_message_index(opcode);
-    if (index != -1) {
-        // resend the important message
-        ESP_LOGW(TAG_M, "Confirm delivered on Important Message, index: %d", index);
-        clear_important_message(index);
-    }
+    // important message acks are matched by sequence in root module
 }
 
 // timeout_handler() get triger when module previously sent an message that requires response but didn't receive response
 static void timeout_handler(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode) {
     ESP_LOGI(TAG_M, " ----------- timeout handler trigered -----------");
-    
-    // cehck for retransmition
-    int8_t index = get_important_message_index(opcode);
-    if (index != -1) {
-        // resend the important message
-        retransmit_important_message(ctx, opcode, index);
-    }
+    // important messages are retransmitted by root module on their own timer
 }
 
 // broadcast_handler() get triger when module recived an broadcast message
@@ -141,26 +130,58 @@ static void connectivity_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
     send_response(ctx, response_length, (uint8_t *)response, ECS_193_MODEL_OP_CONNECTIVITY);
 }
 
+// group_status_handler() get triger when a node applied a group subscription change (MESH_GROUP_* status)
+static void group_status_handler(uint16_t group_addr, uint16_t node_addr, uint8_t status) {
+    ESP_LOGI(TAG_M, "Group 0x%04x, node-0x%04x subscription status %d", group_addr, node_addr, status);
+
+    uint8_t buffer[OPCODE_LEN + NODE_ADDR_LEN * 2 + 1];
+    uint16_t group_addr_network_endian = htons(group_addr);
+    uint16_t node_addr_network_endian = htons(node_addr);
+
+    buffer[0] = UART_MSG_GROUP_STATUS;
+    memcpy(buffer + OPCODE_LEN, &group_addr_network_endian, NODE_ADDR_LEN);
+    memcpy(buffer + OPCODE_LEN + NODE_ADDR_LEN, &node_addr_network_endian, NODE_ADDR_LEN);
+    buffer[OPCODE_LEN + NODE_ADDR_LEN * 2] = status;
+    uart_sendData(0, buffer, sizeof(buffer));
+}
+
+// tx_flow_handler() get triger when the mesh tx queue crosses a watermark, host holds sends while paused
+static void tx_flow_handler(bool paused, uint8_t queued) {
+    uint8_t buffer[OPCODE_LEN + 3];
+
+    buffer[0] = UART_MSG_TX_FLOW;
+    buffer[OPCODE_LEN] = (paused ? UART_TX_XOFF : UART_TX_XON);
+    buffer[OPCODE_LEN + 1] = queued;
+    buffer[OPCODE_LEN + 2] = MESH_TX_QUEUE_LEN;
+    uart_sendData(0, buffer, sizeof(buffer));
+}
+
 /***************** Other Functions *****************/
-static void send_network_info() {
-    // craft bytes of network info and send to uart
-    uint16_t node_count = esp_ble_mesh_provisioner_get_prov_node_count();
+static void send_network_info(void) {
+    // craft bytes of network info and send to uart, from root's node table so the mesh callbacks can't change it meanwhile
+    uint16_t table_size = 0;
+    const esp_ble_mesh_node_info_t* table = get_node_info_table(&table_size);
+
+    node_table_lock();
+    uint16_t node_count = 0;
+    for (int i = 0; i < table_size; i++) {
+        if (table[i].unicast != ESP_BLE_MESH_ADDR_UNASSIGNED && !table[i].removed) {
+            node_count += 1;
+        }
+    }
     uint16_t node_left = node_count;
-    const esp_ble_mesh_node_t **nodeTableEntry = esp_ble_mesh_provisioner_get_node_table_entry();
 
     // 18 byte per node, send up to 40 node everytime
-    uint8_t node_data_size = NODE_ADDR_LEN + NODE_UUID_LEN; // node_addr + node_uuid size
-    uint8_t buffer_size = OPCODE_LEN + 1 + 40 * node_data_size; // 3 byte opcode, 1 byte node amount, up to 40 node
-    uint8_t* buffer = (uint8_t*) malloc(buffer_size * sizeof(uint8_t));
+    // 1 byte opcode, 1 byte node amount, up to 40 node
+    static uint8_t buffer[OPCODE_LEN + 1 + NET_INFO_BATCH * (NODE_ADDR_LEN + NODE_UUID_LEN)];
 
-    buffer[0] = 0x01; //network info
+    buffer[0] = UART_MSG_NET_INFO; //network info
 
     int node_index = 0;
     while (node_left > 0)
     {
-        const esp_ble_mesh_node_t *node_itr = nodeTableEntry[node_index];
         // compute current ctach, max 40
-        uint8_t batch_size = (node_left < 40 ? node_left : 40);
+        uint8_t batch_size = (node_left < NET_INFO_BATCH ? node_left : NET_INFO_BATCH);
         uint8_t* buffer_itr = buffer + OPCODE_LEN;
 
         // load batch size (1 byte node amount)
@@ -169,13 +190,19 @@ static void send_network_info() {
 
         // load all node data in this batch
         for (int i = 0; i < batch_size; ++i) {
+            // skip free slots and deleted nodes
+            while (table[node_index].unicast == ESP_BLE_MESH_ADDR_UNASSIGNED || table[node_index].removed) {
+                node_index += 1;
+            }
+            const esp_ble_mesh_node_info_t *node_itr = &table[node_index];
+
             // load current node
-            uint16_t node_addr = node_itr->unicast_addr;
+            uint16_t node_addr = node_itr->unicast;
             uint16_t node_addr_network_endian = htons(node_addr);
 
             memcpy(buffer_itr, &node_addr_network_endian, NODE_ADDR_LEN);
             buffer_itr += NODE_ADDR_LEN;
-            memcpy(buffer_itr, node_itr->dev_uuid, NODE_UUID_LEN);
+            memcpy(buffer_itr, node_itr->uuid, NODE_UUID_LEN);
             buffer_itr += NODE_UUID_LEN;
 
             // move to next node
@@ -185,128 +212,534 @@ static void send_network_info() {
         uart_sendData(0, buffer, buffer_itr-buffer);
         node_left -= batch_size;
     }
-    free(buffer);
+    node_table_unlock();
 }
 
-static void execute_uart_command(char* command, size_t cmd_total_len) {
-    ESP_LOGI(TAG_M, "execute_command called");
-    static const char *TAG_E = "EXE";
-    static uint8_t *data_buffer = NULL;
-    if (data_buffer == NULL) {
-        data_buffer = (uint8_t*)malloc(128);
-        if (data_buffer == NULL) {
-            printf("Memory allocation failed.\n");
-            return;
+static uint8_t node_state(const esp_ble_mesh_node_info_t* node) {
+    return (node->removed ? UART_NODE_REMOVED : (node->configured ? UART_NODE_CONFIGURED : UART_NODE_PROVISIONED));
+}
+
+// send the nodes changed after since_version, or the whole table when host's version is from another boot or too old
+static void send_network_delta(uint32_t host_epoch, uint32_t since_version) {
+    static uint8_t buffer[NET_DELTA_HEADER_LEN + NET_INFO_BATCH * NET_DELTA_NODE_LEN];
+    uint32_t epoch = 0;
+    uint32_t floor = 0;
+    uint16_t table_size = 0;
+    const esp_ble_mesh_node_info_t* table = get_node_info_table(&table_size);
+
+    // version and records from one state of the table, no half updated record and no version skipped
+    node_table_lock();
+    uint32_t version = get_topology_version(&epoch, &floor);
+
+    uint8_t flags = 0;
+    if (host_epoch != epoch || since_version < floor || since_version > version) {
+        flags |= UART_NET_DELTA_FULL;
+        since_version = 0;
+    }
+
+    uint32_t epoch_network_endian = htonl(epoch);
+    uint32_t version_network_endian = htonl(version);
+    buffer[0] = UART_MSG_NET_DELTA;
+    memcpy(buffer + OPCODE_LEN, &epoch_network_endian, 4);
+    memcpy(buffer + OPCODE_LEN + 4, &version_network_endian, 4);
+
+    int node_index = 0;
+    do {
+        uint8_t batch_size = 0;
+        uint8_t* buffer_itr = buffer + NET_DELTA_HEADER_LEN;
+
+        for (; node_index < table_size && batch_size < NET_INFO_BATCH; node_index++) {
+            const esp_ble_mesh_node_info_t* node = &table[node_index];
+            if (node->unicast == ESP_BLE_MESH_ADDR_UNASSIGNED || node->version <= since_version) {
+                continue;
+            }
+            if (node->removed && (flags & UART_NET_DELTA_FULL)) {
+                continue; // host rebuilds its table from scratch, no removal to report
+            }
+
+            uint16_t node_addr_network_endian = htons(node->unicast);
+            *buffer_itr++ = node_state(node);
+            memcpy(buffer_itr, &node_addr_network_endian, NODE_ADDR_LEN);
+            buffer_itr += NODE_ADDR_LEN;
+            memcpy(buffer_itr, node->uuid, NODE_UUID_LEN);
+            buffer_itr += NODE_UUID_LEN;
+            batch_size += 1;
+        }
+
+        // more frames follow if any changed node is left
+        bool more = false;
+        for (int i = node_index; i < table_size && !more; i++) {
+            more = (table[i].unicast != ESP_BLE_MESH_ADDR_UNASSIGNED && table[i].version > since_version &&
+                    !(table[i].removed && (flags & UART_NET_DELTA_FULL)));
+        }
+
+        buffer[OPCODE_LEN + 8] = flags | (more ? UART_NET_DELTA_MORE : 0);
+        buffer[OPCODE_LEN + 9] = batch_size;
+        uart_sendData(0, buffer, buffer_itr - buffer);
+        if (!more) {
+            break;
+        }
+    } while (1);
+    node_table_unlock();
+}
+
+// bytes of one node query record with the selected fields
+static size_t node_record_len(const esp_ble_mesh_node_info_t* node, uint16_t fields) {
+    size_t length = NODE_ADDR_LEN;
+
+    if (fields & UART_NODE_FIELD_UUID) length += NODE_UUID_LEN;
+    if (fields & UART_NODE_FIELD_STATE) length += 1;
+    if (fields & UART_NODE_FIELD_VERSION) length += 4;
+    if (fields & UART_NODE_FIELD_LAST_SEEN) length += 4;
+    if (fields & UART_NODE_FIELD_LINK) length += 2;
+    if (fields & UART_NODE_FIELD_TTL) length += 3;
+    if (fields & UART_NODE_FIELD_RTT) length += 12;
+    if (fields & UART_NODE_FIELD_COMPOSITION) {
+        length += 1; // element amount
+        for (int i = 0; i < node->elem_num; i++) {
+            length += 2; // sig and vendor model amount
+            if (node->sig_model_num != NULL && node->vnd_model_num != NULL) {
+                length += node->sig_model_num[i] * 2 + node->vnd_model_num[i] * 4;
+            }
         }
     }
+    return length;
+}
 
-    // ============= process and execute commands from net server (from uart) ==================
-    // uart command format
-    // TB Finish, TB Complete
-    if (cmd_total_len < 5) {
-        ESP_LOGE(TAG_E, "Command [%s] with %d byte too short", command, cmd_total_len);
-        uart_sendMsg(0, "Error: Command Too Short\n");
-        return;
+static uint8_t* node_record_load(uint8_t* buffer_itr, const esp_ble_mesh_node_info_t* node, uint16_t fields, int64_t now) {
+    uint16_t u16_network_endian = htons(node->unicast);
+    memcpy(buffer_itr, &u16_network_endian, NODE_ADDR_LEN);
+    buffer_itr += NODE_ADDR_LEN;
+
+    if (fields & UART_NODE_FIELD_UUID) {
+        memcpy(buffer_itr, node->uuid, NODE_UUID_LEN);
+        buffer_itr += NODE_UUID_LEN;
+    }
+    if (fields & UART_NODE_FIELD_STATE) {
+        *buffer_itr++ = node_state(node);
+    }
+    if (fields & UART_NODE_FIELD_VERSION) {
+        uint32_t u32_network_endian = htonl(node->version);
+        memcpy(buffer_itr, &u32_network_endian, 4);
+        buffer_itr += 4;
+    }
+    if (fields & UART_NODE_FIELD_LAST_SEEN) {
+        // ms since last heard, 0xFFFFFFFF if never
+        int64_t age_ms = (node->last_seen == 0 ? UINT32_MAX : (now - node->last_seen) / 1000);
+        uint32_t u32_network_endian = htonl(age_ms < UINT32_MAX ? (uint32_t) age_ms : UINT32_MAX);
+        memcpy(buffer_itr, &u32_network_endian, 4);
+        buffer_itr += 4;
+    }
+    if (fields & UART_NODE_FIELD_LINK) {
+        *buffer_itr++ = (uint8_t) node->last_rssi;
+        *buffer_itr++ = node->last_ttl;
     }
+    if (fields & UART_NODE_FIELD_COMPOSITION) {
+        *buffer_itr++ = node->elem_num;
+        for (int i = 0; i < node->elem_num; i++) {
+            bool parsed = (node->sig_model_num != NULL && node->vnd_model_num != NULL);
+            uint8_t sig_num = (parsed ? node->sig_model_num[i] : 0);
+            uint8_t vnd_num = (parsed ? node->vnd_model_num[i] : 0);
+            *buffer_itr++ = sig_num;
+            *buffer_itr++ = vnd_num;
+            for (int j = 0; j < sig_num; j++) {
+                u16_network_endian = htons(node->sig_models[i][j]);
+                memcpy(buffer_itr, &u16_network_endian, 2);
+                buffer_itr += 2;
+            }
+            for (int j = 0; j < vnd_num; j++) {
+                uint32_t u32_network_endian = htonl(node->vnd_models[i][j]); // company id << 16 | model id
+                memcpy(buffer_itr, &u32_network_endian, 4);
+                buffer_itr += 4;
+            }
+        }
+    }
+    if (fields & UART_NODE_FIELD_TTL) {
+        *buffer_itr++ = node->hops;
+        *buffer_itr++ = get_node_ttl(node->unicast);
+        *buffer_itr++ = node->ttl_override;
+    }
+    if (fields & UART_NODE_FIELD_RTT) {
+        uint32_t u32_network_endian = htonl(node->srtt_us);
+        memcpy(buffer_itr, &u32_network_endian, 4);
+        u32_network_endian = htonl(node->rttvar_us);
+        memcpy(buffer_itr + 4, &u32_network_endian, 4);
+        u32_network_endian = htonl(get_node_timeout(node->unicast));
+        memcpy(buffer_itr + 8, &u32_network_endian, 4);
+        buffer_itr += 12;
+    }
+    return buffer_itr;
+}
 
-    // ====== core commands ====== 
-    if (strncmp(command, CMD_GET_NET_INFO, CMD_LEN) == 0) {
-        send_network_info();
-    } 
-    else if (strncmp(command, CMD_SEND_MSG, CMD_LEN) == 0) {
-        ESP_LOGI(TAG_E, "executing \'SEND-\'");
-        char *address_start = command + CMD_LEN;
-        char *msg_start = address_start + NODE_ADDR_LEN;
-        size_t msg_length = cmd_total_len - CMD_LEN - NODE_ADDR_LEN;
+// one frame of node records starting at cursor (node table index), host continues with the returned cursor
+static void send_node_query(uint16_t cursor, uint16_t fields, uint8_t max_nodes) {
+    static uint8_t buffer[UART_BUF_SIZE];
+    uint16_t table_size = 0;
+    const esp_ble_mesh_node_info_t* table = get_node_info_table(&table_size);
+    int64_t now = esp_timer_get_time();
+
+    uint8_t* buffer_itr = buffer + NODE_QUERY_HEADER_LEN;
+    uint8_t node_amount = 0;
+    uint16_t node_index = cursor;
+
+    // composition data can be freed and rebuilt by the mesh callbacks, length and load must see the same record
+    node_table_lock();
+    for (; node_index < table_size; node_index++) {
+        const esp_ble_mesh_node_info_t* node = &table[node_index];
+        if (node->unicast == ESP_BLE_MESH_ADDR_UNASSIGNED || node->removed) {
+            continue;
+        }
+        if (node_amount == UINT8_MAX || (max_nodes != 0 && node_amount == max_nodes)) {
+            break;
+        }
 
-        if (cmd_total_len < CMD_LEN + NODE_ADDR_LEN) {
-            uart_sendMsg(0, "Error: No Dst Address Attached\n");
-            return;
-        } else if (msg_length <= 0) {
-            uart_sendMsg(0, "Error: No Message Attached\n");
-            return;
+        size_t record_len = node_record_len(node, fields);
+        if (record_len > sizeof(buffer) - NODE_QUERY_HEADER_LEN) {
+            ESP_LOGE(TAG_M, "Node-0x%04x record of %d byte never fits a frame, skipped", node->unicast, record_len);
+            continue;
+        }
+        if (buffer_itr + record_len > buffer + sizeof(buffer)) {
+            break;
         }
 
-        uint16_t node_addr_network_order = 0;
-        memcpy(&node_addr_network_order, address_start, 2);
-        uint16_t node_addr = ntohs(node_addr_network_order);
-        if (node_addr == 0)
-        {
-            node_addr = PROV_OWN_ADDR; // root addr
+        buffer_itr = node_record_load(buffer_itr, node, fields, now);
+        node_amount += 1;
+    }
+
+    // next cursor, UART_NODE_QUERY_END once no node is left
+    uint16_t next_cursor = UART_NODE_QUERY_END;
+    for (; node_index < table_size; node_index++) {
+        if (table[node_index].unicast != ESP_BLE_MESH_ADDR_UNASSIGNED && !table[node_index].removed) {
+            next_cursor = node_index;
+            break;
         }
-        
-        ESP_LOGI(TAG_E, "Sending message to address-%d ...", node_addr);
-        send_message(node_addr, msg_length, (uint8_t *) msg_start, false);
-        ESP_LOGW(TAG_M, "<- Sended Message [%s]", (char *)msg_start);
-    } 
-    else if (strncmp(command, CMD_BROADCAST_MSG, CMD_LEN) == 0) {
-        ESP_LOGI(TAG_E, "executing \'BCAST\'");
-        char *msg_start = command + CMD_LEN + NODE_ADDR_LEN;
-        size_t msg_length = cmd_total_len - CMD_LEN - NODE_ADDR_LEN;
-
-        broadcast_message(msg_length, (uint8_t *)msg_start);
-    }
-    else if (strncmp(command, CMD_RESET_ROOT, 5) == 0) {
-        ESP_LOGI(TAG_E, "executing \'RST-R\'");
-        esp_restart();
-    }
-    else if (strncmp(command, CMD_CLEAN_NETWORK_CONFIG, 5) == 0)
+    }
+    node_table_unlock();
+
+    uint16_t next_cursor_network_endian = htons(next_cursor);
+    uint16_t fields_network_endian = htons(fields);
+    buffer[0] = UART_MSG_NODE_QUERY;
+    memcpy(buffer + OPCODE_LEN, &next_cursor_network_endian, 2);
+    memcpy(buffer + OPCODE_LEN + 2, &fields_network_endian, 2);
+    buffer[OPCODE_LEN + 4] = node_amount;
+    uart_sendData(0, buffer, buffer_itr - buffer);
+}
+
+/***************** Uart Command Actions *****************/
+// message buffer pools, high water close to the block amount means the pool is sized too small
+static void send_pool_stats(void) {
+    mesh_slab_stats_t stats[2];
+    uint8_t pool_amount = get_message_pool_stats(stats, 2);
+    uint8_t buffer[OPCODE_LEN + 1 + 2 * 12];
+    uint8_t* buffer_itr = buffer + OPCODE_LEN + 1;
+
+    buffer[0] = UART_MSG_POOL_STATS;
+    buffer[OPCODE_LEN] = pool_amount;
+    for (int i = 0; i < pool_amount; i++) {
+        uint16_t u16_network_endian[4] = { htons(stats[i].block_size), htons(stats[i].block_count), htons(stats[i].in_use), htons(stats[i].high_water) };
+        uint32_t failures_network_endian = htonl(stats[i].failures);
+        memcpy(buffer_itr, u16_network_endian, 8);
+        memcpy(buffer_itr + 8, &failures_network_endian, 4);
+        buffer_itr += 12;
+    }
+    uart_sendData(0, buffer, buffer_itr - buffer);
+}
+
+// important messages waiting for their ack, after the OUTBX action
+static void command_outbox(uint8_t action) {
+    static mesh_outbox_entry_t entries[MESH_IMPORTANT_MAX_INFLIGHT];
+    static uint8_t buffer[OPCODE_LEN + 2 + MESH_IMPORTANT_MAX_INFLIGHT * 8];
+    uint8_t* buffer_itr = buffer + OPCODE_LEN + 2;
+    esp_err_t err = ESP_OK;
+
+    if (action == CMD_OUTBOX_SYNC) {
+        err = sync_outbox();
+    } else if (action == CMD_OUTBOX_CLEAR) {
+        err = clear_outbox();
+    }
+    uint8_t entry_amount = get_outbox_entries(entries, MESH_IMPORTANT_MAX_INFLIGHT);
+
+    buffer[0] = UART_MSG_OUTBOX;
+    buffer[OPCODE_LEN] = (err == ESP_OK ? UART_OUTBOX_OK : (err == ESP_ERR_INVALID_STATE ? UART_OUTBOX_NO_JOURNAL : UART_OUTBOX_NVS_ERROR));
+    buffer[OPCODE_LEN + 1] = entry_amount;
+    for (int i = 0; i < entry_amount; i++) {
+        uint16_t u16_network_endian[2] = { htons(entries[i].dst_address), htons(entries[i].seq) };
+        uint16_t length_network_endian = htons(entries[i].length);
+        memcpy(buffer_itr, u16_network_endian, 4);
+        buffer_itr[4] = entries[i].retransmits;
+        buffer_itr[5] = entries[i].stored;
+        memcpy(buffer_itr + 6, &length_network_endian, 2);
+        buffer_itr += 8;
+    }
+    uart_sendData(0, buffer, buffer_itr - buffer);
+}
+
+// transfer progress, host streams XDATA up to offset + MESH_XFER_WINDOW * MESH_XFER_CHUNK_LEN on MESH_XFER_PROGRESS
+static void transfer_status_handler(uint16_t node_addr, uint8_t status, uint32_t offset) {
+    uint8_t buffer[OPCODE_LEN + 1 + NODE_ADDR_LEN + 4];
+    uint16_t node_addr_network_endian = htons(node_addr);
+    uint32_t offset_network_endian = htonl(offset);
+
+    buffer[0] = UART_MSG_TRANSFER;
+    buffer[OPCODE_LEN] = status;
+    memcpy(buffer + OPCODE_LEN + 1, &node_addr_network_endian, NODE_ADDR_LEN);
+    memcpy(buffer + OPCODE_LEN + 1 + NODE_ADDR_LEN, &offset_network_endian, 4);
+    uart_sendData(0, buffer, sizeof(buffer));
+}
+
+static void command_transfer_open(uint16_t node_addr, uint32_t total_length) {
+    esp_err_t err = transfer_open(node_addr, total_length, transfer_status_handler);
+    if (err == ESP_ERR_NOT_FOUND) {
+        uart_sendMsg(node_addr, "Node not exists in network\n");
+    } else if (err == ESP_ERR_INVALID_STATE) {
+        uart_sendMsg(0, "Error: Transfer Already Active\n");
+    } else if (err != ESP_OK) {
+        uart_sendMsg(0, "Error: Invalid Transfer Length\n");
+    }
+}
+
+static void command_set_node_ttl(uint16_t node_addr, uint8_t ttl) {
+    if (node_addr == 0) {
+        if (ttl > MESH_TTL_MAX || ttl == 1) {
+            uart_sendMsg(0, "Error: Invalid TTL\n");
+            return;
+        }
+        set_message_ttl(ttl);
+        return;
+    }
+
+    esp_err_t err = set_node_ttl(node_addr, ttl);
+    if (err == ESP_ERR_NOT_FOUND) {
+        uart_sendMsg(node_addr, "Node not exists in network\n");
+    } else if (err != ESP_OK) {
+        uart_sendMsg(0, "Error: Invalid TTL\n");
+    }
+}
+
+static void command_transfer_write(uint32_t offset, uint16_t length, uint8_t* data) {
+    if (transfer_write(offset, length, data) == ESP_ERR_INVALID_STATE) {
+        uart_sendMsg(0, "Error: No Active Transfer\n");
+    }
+}
+
+static void command_send_message(uint16_t node_addr, uint16_t length, uint8_t* data) {
+    if (node_addr == 0)
     {
-        ESP_LOGI(TAG_E, "executing \'CLEAN\'");
-        uart_sendMsg(0, " - Reseting Root Module\n");
-        reset_esp32();
+        node_addr = PROV_OWN_ADDR; // root addr
     }
+    send_message(node_addr, length, data, false);
+    ESP_LOGW(TAG_M, "<- Sended Message [%.*s]", length, (char *)data);
+}
 
-    // ====== other dev/debug use command ====== 
-    // else if (strncmp(command, "ECHO-", 5) == 0) {
-    //     // echo test
-    //     ESP_LOGW(TAG_M, "recived \'ECHO-\' command");
-    //     strcpy((char*) data_buffer, command);
-    //     strcpy(((char*) data_buffer) + strlen(command), "; [ESP] confirm recived from uart; \n");
-    //     uart_sendData(0, data_buffer, strlen((char *)data_buffer) + 1);
-    // }
+// outcome of a SENDT, request id is the host's
+static void tagged_send_complete_handler(uint16_t request_id, uint16_t node_addr, uint8_t status, uint32_t latency_us) {
+    uint8_t buffer[OPCODE_LEN + 2 + NODE_ADDR_LEN + 1 + 4];
+    uint16_t request_id_network_endian = htons(request_id);
+    uint16_t node_addr_network_endian = htons(node_addr);
+    uint32_t latency_network_endian = htonl(latency_us);
+
+    buffer[0] = UART_MSG_SEND_STATUS;
+    memcpy(buffer + OPCODE_LEN, &request_id_network_endian, 2);
+    memcpy(buffer + OPCODE_LEN + 2, &node_addr_network_endian, NODE_ADDR_LEN);
+    buffer[OPCODE_LEN + 2 + NODE_ADDR_LEN] = status; // MESH_SEND_*
+    memcpy(buffer + OPCODE_LEN + 2 + NODE_ADDR_LEN + 1, &latency_network_endian, 4);
+    uart_sendData(0, buffer, sizeof(buffer));
+}
 
-    // ====== Not Supported  command ======
-    else {
-        ESP_LOGE(TAG_E, "Command not Vaild");
+static void command_send_tagged_message(uint16_t request_id, uint16_t node_addr, bool require_response, uint16_t length, uint8_t* data) {
+    if (node_addr == 0)
+    {
+        node_addr = PROV_OWN_ADDR; // root addr
     }
 
-    
-    ESP_LOGI(TAG_E, "Command [%.*s] executed", cmd_total_len, command);
+    esp_err_t err = send_tagged_message(request_id, node_addr, length, data, require_response, tagged_send_complete_handler);
+    if (err == ESP_ERR_NOT_FOUND) {
+        tagged_send_complete_handler(request_id, node_addr, MESH_SEND_NO_NODE, 0);
+    } else if (err == ESP_ERR_NO_MEM) {
+        tagged_send_complete_handler(request_id, node_addr, MESH_SEND_BUSY, 0);
+    } else if (err != ESP_OK) {
+        tagged_send_complete_handler(request_id, node_addr, MESH_SEND_FAILED, 0);
+    }
 }
 
-static void uart_task_handler(char *data) {
-    ESP_LOGW(TAG_M, "uart_task_handler called ------------------");
+// summary of a MSEND fan-out, one frame for every destination
+static void multi_send_complete_handler(const uint16_t* node_addrs, const uint8_t* results, uint8_t node_count) {
+    static uint8_t buffer[OPCODE_LEN + 1 + MESH_FANOUT_MAX_DST * (NODE_ADDR_LEN + 1)];
+    uint8_t* buffer_itr = buffer;
+
+    *buffer_itr++ = UART_MSG_MULTI_SEND;
+    *buffer_itr++ = node_count;
+    for (int i = 0; i < node_count; i++) {
+        uint16_t node_addr_network_endian = htons(node_addrs[i]);
+        memcpy(buffer_itr, &node_addr_network_endian, NODE_ADDR_LEN);
+        buffer_itr += NODE_ADDR_LEN;
+        *buffer_itr++ = results[i]; // MESH_SEND_* result
+    }
 
-    int cmd_start = 0;
-    int cmd_end = 0;
-    int cmd_len = 0;
+    uart_sendData(0, buffer, buffer_itr - buffer);
+}
 
-    for (int i = 0; i < UART_BUF_SIZE; i++) {
-        if (data[i] == 0xFF) {
-            // located start of message
-            cmd_start = i + 1; // start byte of actual message
-        }else if (data[i] == 0xFE) {
-            // located end of message
-            cmd_end = i; // 0xFE byte
+static void command_send_multi_message(uint16_t* node_addrs, uint8_t node_count, uint16_t length, uint8_t* data) {
+    for (int i = 0; i < node_count; i++) {
+        if (node_addrs[i] == 0) {
+            node_addrs[i] = PROV_OWN_ADDR; // root addr
         }
+    }
 
-        if (cmd_end > cmd_start) {
-            // located a message, message at least 1 byte
-            uint8_t* command = (uint8_t *) (data + cmd_start);
-            cmd_len = cmd_end - cmd_start;
-            cmd_len = uart_decoded_bytes(command, cmd_len, command); // decoded cmd will be put back to command pointer
-            ESP_LOGE("Decoded Data", "i:%d, cmd_start:%d, cmd_len:%d", i, cmd_start, cmd_len);
+    esp_err_t err = send_message_multi(node_addrs, node_count, length, data, multi_send_complete_handler);
+    if (err == ESP_ERR_INVALID_STATE) {
+        uart_sendMsg(0, "Error: Previous Multi Send Still Running\n");
+    } else if (err == ESP_ERR_INVALID_ARG) {
+        uart_sendMsg(0, "Error: Too Many Dst Address or Message Too Long\n");
+    } else if (err != ESP_OK) {
+        uart_sendMsg(0, "Error: Failed to Start Multi Send\n");
+    }
+}
+
+static void command_group_error(esp_err_t err) {
+    if (err == ESP_ERR_INVALID_ARG) {
+        uart_sendMsg(0, "Error: Not a Group Address\n");
+    } else if (err == ESP_ERR_NO_MEM) {
+        uart_sendMsg(0, "Error: Group Table Full\n");
+    } else if (err == ESP_ERR_INVALID_STATE) {
+        uart_sendMsg(0, "Error: Previous Group Change Still Running, Retry Later\n");
+    } else if (err != ESP_OK) {
+        uart_sendMsg(0, "Error: Failed to Send to Group\n");
+    }
+}
+
+static void command_add_group_members(uint16_t group_addr, uint16_t* node_addrs, uint16_t node_count) {
+    command_group_error(add_group_members(group_addr, node_addrs, node_count));
+}
 
-            execute_uart_command(data + cmd_start, cmd_len); //TB Finish, don't execute at the moment
-            cmd_start = cmd_end;
+static void command_delete_group_members(uint16_t group_addr, uint16_t* node_addrs, uint16_t node_count) {
+    command_group_error(delete_group_members(group_addr, node_addrs, node_count));
+}
+
+static void command_send_group_message(uint16_t group_addr, uint16_t length, uint8_t* data) {
+    command_group_error(send_group_message(group_addr, length, data));
+}
+
+static const uart_command_ops_t command_ops = {
+    .reply = uart_sendData,
+    .send_network_info = send_network_info,
+    .send_pool_stats = send_pool_stats,
+    .outbox = command_outbox,
+    .send_network_delta = send_network_delta,
+    .send_node_query = send_node_query,
+    .send_message = command_send_message,
+    .send_tagged_message = command_send_tagged_message,
+    .send_multi_message = command_send_multi_message,
+    .broadcast_message = broadcast_message,
+    .add_group_members = command_add_group_members,
+    .delete_group_members = command_delete_group_members,
+    .send_group_message = command_send_group_message,
+    .transfer_open = command_transfer_open,
+    .transfer_write = command_transfer_write,
+    .transfer_abort = transfer_abort,
+    .set_node_ttl = command_set_node_ttl,
+    .restart = esp_restart,
+    .reset_network = reset_esp32,
+    .request_baud_rate = uart_link_request_baud_rate,
+    .confirm_baud_rate = uart_link_confirm_baud_rate,
+    .set_link_mode = uart_link_set_mode,
+    .benchmark = uart_codec_benchmark,
+};
+
+/***************** Command Queue *****************/
+// decoded commands wait here for the dispatch task, so a slow mesh call never stalls uart rx
+typedef struct {
+    size_t length;
+    uint8_t data[UART_BUF_SIZE];
+} uart_command_buffer_t;
+
+static uart_command_buffer_t command_pool[UART_CMD_POOL_SIZE];
+static QueueHandle_t command_free_queue = NULL;                            // free buffers of command_pool
+static QueueHandle_t command_queues[UART_COMMAND_QUEUED_CLASSES] = { NULL }; // one per class, UART_COMMAND_CONTROL first
+static SemaphoreHandle_t command_pending = NULL;                          // commands queued over all classes
+
+static void command_queue_init(void) {
+    command_free_queue = xQueueCreate(UART_CMD_POOL_SIZE, sizeof(uart_command_buffer_t*));
+    for (int i = 0; i < UART_COMMAND_QUEUED_CLASSES; i++) {
+        command_queues[i] = xQueueCreate(UART_CMD_POOL_SIZE, sizeof(uart_command_buffer_t*));
+    }
+    command_pending = xSemaphoreCreateCounting(UART_CMD_POOL_SIZE, 0);
+
+    for (int i = 0; i < UART_CMD_POOL_SIZE; i++) {
+        uart_command_buffer_t* buffer = &command_pool[i];
+        xQueueSend(command_free_queue, &buffer, 0);
+    }
+}
+
+static void dispatch_task(void *arg) {
+    uart_command_buffer_t* buffer = NULL;
+
+    while (1) {
+        xSemaphoreTake(command_pending, portMAX_DELAY);
+
+        // highest class with a command wins, bulk only runs when no control command waits
+        for (int i = 0; i < UART_COMMAND_QUEUED_CLASSES; i++) {
+            if (xQueueReceive(command_queues[i], &buffer, 0) == pdTRUE) {
+                uart_command_execute(buffer->data, buffer->length);
+                xQueueSend(command_free_queue, &buffer, 0);
+                break;
+            }
+        }
+    }
+}
+
+static void uart_frame_handler(uint8_t* frame, size_t length) {
+    ESP_LOGI("Decoded Data", "cmd_len:%d", length);
+
+    // verb is at the start, the seq trailer doesn't change the class, buffer taken before the seq is acked
+    uint8_t command_class = uart_command_class(frame, length);
+    uart_command_buffer_t* buffer = NULL;
+    if (command_class != UART_COMMAND_LINK) {
+        xQueueReceive(command_free_queue, &buffer, 0);
+    }
+    bool has_room = (command_class == UART_COMMAND_LINK || buffer != NULL);
+
+    if (!uart_link_accept_frame(frame, &length, has_room)) {
+        if (buffer != NULL) {
+            xQueueSend(command_free_queue, &buffer, 0);
         }
+        return; // corrupted, duplicate or no room, ack/nack already sent
+    }
+
+    if (command_class == UART_COMMAND_LINK) {
+        uart_command_execute(frame, length);
+        return;
     }
 
-    if (cmd_start > cmd_end) {
-        // one message is only been read half into buffer, edge case. Not consider at the moment
-        ESP_LOGE("E", "Buffer might have remaining half message!! cmd_start:%d, cmd_end:%d", cmd_start, cmd_end);
-        uart_sendMsg(0, "[Warning] Buffer might have remaining half message!!\n");
+    if (buffer == NULL) {
+        // plain link only, a sequenced frame without room was nacked above
+        ESP_LOGE(TAG_M, "Command queue full, dropping [%.*s]", length < CMD_LEN ? length : CMD_LEN, (char*) frame);
+        uart_sendMsg(0, "Error: Command Queue Full\n");
+        return;
+    }
+
+    memcpy(buffer->data, frame, length);
+    buffer->length = length;
+    xQueueSend(command_queues[command_class], &buffer, 0);
+    xSemaphoreGive(command_pending);
+}
+
+// read everything buffered in the driver and feed it into the decoder
+static void uart_rx_drain(uart_decoder_t* decoder, uint8_t* data) {
+    const uart_transport_t* transport = uart_get_transport();
+    size_t buffered_len = 0;
+    uart_get_buffered_data_len(UART_NUM, &buffered_len);
+
+    while (buffered_len > 0) {
+        size_t read_len = (buffered_len < UART_BUF_SIZE ? buffered_len : UART_BUF_SIZE);
+        const int rxBytes = transport->read(transport->ctx, data, read_len, 0);
+        if (rxBytes <= 0) {
+            break;
+        }
+
+        uart_decoder_feed(decoder, data, rxBytes, uart_frame_handler);
+        uart_decoder_set_mode(decoder, uart_link_get_rx_mode()); // LINK- command may have switched framing
+        buffered_len -= rxBytes;
     }
 }
 
@@ -316,21 +749,50 @@ static void rx_task(void *arg)
     // esp_log_level_set(RX_TASK_TAG, ESP_LOG_NONE);
 
     static const char *RX_TASK_TAG = "RX";
-    uint8_t* data = (uint8_t*) malloc(UART_BUF_SIZE + 1);
+    static uint8_t frame_buffer[UART_BUF_SIZE];
+    static uint8_t data[UART_BUF_SIZE];
+    uart_decoder_t decoder;
+    uart_event_t event;
+    QueueHandle_t uart_queue = uart_get_event_queue();
     ESP_LOGW(RX_TASK_TAG, "rx_task called ------------------");
 
+    uart_decoder_init(&decoder, frame_buffer, sizeof(frame_buffer));
+
     while (1)
     {
-        memset(data, 0, UART_BUF_SIZE);
-        const int rxBytes = uart_read_bytes(UART_NUM, data, UART_BUF_SIZE, 1000 / portTICK_PERIOD_MS);
-        if (rxBytes > 0) {
-            // ESP_LOGI(RX_TASK_TAG, "Read %d bytes: '%s'", rxBytes, data);
-            // uart_sendMsg(rxBytes, " readed from RX\n");
+        // block until driver reports data, task wakes right when a UART_END byte arrives
+        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
 
-            uart_task_handler((char*) data);
+        switch (event.type) {
+        case UART_PATTERN_DET:
+            // end of frame received, drain so the frame completes now
+            uart_rx_drain(&decoder, data);
+            while (uart_pattern_pop_pos(UART_NUM) != -1) {
+                // positions not needed, decoder locates the frame itself
+            }
+            break;
+        case UART_DATA:
+            // rx timeout or fifo threshold, may only be part of a frame
+            uart_rx_drain(&decoder, data);
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            ESP_LOGE(RX_TASK_TAG, "Uart rx overflow (event %d), flushing input", event.type);
+            uart_flush_input(UART_NUM);
+            xQueueReset(uart_queue);
+            uart_pattern_queue_reset(UART_NUM, UART_EVENT_QUEUE_SIZE);
+            uart_decoder_init(&decoder, frame_buffer, sizeof(frame_buffer));
+            uart_decoder_set_mode(&decoder, uart_link_get_rx_mode());
+            uart_sendMsg(0, "[Warning] Uart rx overflow, input flushed\n");
+            uart_link_report_rx_error();
+            break;
+        default:
+            ESP_LOGW(RX_TASK_TAG, "Uart event type: %d", event.type);
+            break;
         }
     }
-    free(data);
 }
 
 void app_main(void)
@@ -340,7 +802,7 @@ void app_main(void)
     //              - use uart_sendMsg or uart_sendData for message, the esp_log for dev debug
     // esp_log_level_set(TAG_ALL, ESP_LOG_NONE);
     
-    esp_err_t err = esp_module_root_init(prov_complete_handler, config_complete_handler, recv_message_handler, recv_response_handler, timeout_handler, broadcast_handler, connectivity_handler);
+    esp_err_t err = esp_module_root_init(prov_complete_handler, config_complete_handler, recv_message_handler, recv_response_handler, timeout_handler, broadcast_handler, connectivity_handler, group_status_handler, tx_flow_handler);
     if (err != ESP_OK) {
         ESP_LOGE(TAG_M, "Network Module Initialization failed (err %d)", err);
         uart_sendMsg(0, "Error: Network Module Initialization failed\n");
@@ -348,11 +810,15 @@ void app_main(void)
     }
 
     board_init();
+    uart_command_init(&command_ops);
+    command_queue_init();
+    // below the bluetooth tasks, mesh calls from commands never starve the stack
+    xTaskCreate(dispatch_task, "uart_dispatch_task", 1024 * 4, NULL, UART_CMD_DISPATCH_PRIORITY, NULL);
     xTaskCreate(rx_task, "uart_rx_task", 1024 * 2, NULL, configMAX_PRIORITIES - 1, NULL);
 
     char message[15] = "online\n";
     uint8_t message_byte[15];
-    message_byte[0] = 0x03; // Root Reset
+    message_byte[0] = UART_MSG_ROOT_ONLINE; // Root Reset
     memcpy(message_byte + 1, message, strlen(message));
     uart_sendData(0, message_byte, strlen(message) + 1);
     printNetworkInfo(); // esp log for debug
@@ -0,0 +1,74 @@
+/* mesh_slab.c - Lock-free fixed size block pool for message buffers */
+
+#include <stddef.h>
+#include "mesh_slab.h"
+
+#define HEAD_INDEX(head)        ((head) & 0xFFFF)
+#define HEAD_MAKE(tag, index)   (((uint32_t) (tag) << 16) | (index))
+#define HEAD_NEXT_TAG(head)     (((head) >> 16) + 1)
+
+void mesh_slab_init(mesh_slab_t* slab, uint8_t* memory, uint16_t* links, uint16_t block_size, uint16_t block_count) {
+    slab->memory = memory;
+    slab->links = links;
+    slab->block_size = block_size;
+    slab->block_count = block_count;
+
+    for (uint16_t i = 0; i < block_count; i++) {
+        links[i] = (i + 1 < block_count ? i + 1 : MESH_SLAB_END);
+    }
+    atomic_init(&slab->free_head, HEAD_MAKE(0, block_count > 0 ? 0 : MESH_SLAB_END));
+    atomic_init(&slab->in_use, 0);
+    atomic_init(&slab->high_water, 0);
+    atomic_init(&slab->failures, 0);
+}
+
+void* mesh_slab_alloc(mesh_slab_t* slab) {
+    uint32_t head = atomic_load_explicit(&slab->free_head, memory_order_acquire);
+    uint16_t index;
+
+    // pop the free list, a link read from a block another task took meanwhile is discarded by the failing swap
+    do {
+        index = HEAD_INDEX(head);
+        if (index == MESH_SLAB_END) {
+            atomic_fetch_add_explicit(&slab->failures, 1, memory_order_relaxed);
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&slab->free_head, &head, HEAD_MAKE(HEAD_NEXT_TAG(head), slab->links[index]),
+        memory_order_acquire, memory_order_acquire));
+
+    uint32_t in_use = atomic_fetch_add_explicit(&slab->in_use, 1, memory_order_relaxed) + 1;
+    uint32_t high_water = atomic_load_explicit(&slab->high_water, memory_order_relaxed);
+    while (in_use > high_water &&
+        !atomic_compare_exchange_weak_explicit(&slab->high_water, &high_water, in_use, memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+    return slab->memory + (uint32_t) index * slab->block_size;
+}
+
+void mesh_slab_free(mesh_slab_t* slab, void* block) {
+    if (block == NULL) {
+        return;
+    }
+
+    uint16_t index = ((uint8_t*) block - slab->memory) / slab->block_size;
+    uint32_t head = atomic_load_explicit(&slab->free_head, memory_order_relaxed);
+    do {
+        slab->links[index] = HEAD_INDEX(head);
+    } while (!atomic_compare_exchange_weak_explicit(&slab->free_head, &head, HEAD_MAKE(HEAD_NEXT_TAG(head), index),
+        memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_sub_explicit(&slab->in_use, 1, memory_order_relaxed);
+}
+
+bool mesh_slab_owns(const mesh_slab_t* slab, const void* block) {
+    const uint8_t* position = (const uint8_t*) block;
+    return position >= slab->memory && position < slab->memory + (uint32_t) slab->block_count * slab->block_size;
+}
+
+void mesh_slab_get_stats(mesh_slab_t* slab, mesh_slab_stats_t* stats) {
+    stats->block_size = slab->block_size;
+    stats->block_count = slab->block_count;
+    stats->in_use = atomic_load_explicit(&slab->in_use, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&slab->high_water, memory_order_relaxed);
+    stats->failures = atomic_load_explicit(&slab->failures, memory_order_relaxed);
+}
@@ -0,0 +1,79 @@
+/* mesh_slab.h - Lock-free fixed size block pool for message buffers */
+
+// blocks come from storage sized at build time, alloc and free are O(1), never touch the heap and never block,
+// safe from any task or callback
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifndef _MESH_SLAB_H_
+#define _MESH_SLAB_H_
+
+#define MESH_SLAB_BLOCK_SIZE(size) (((size) + 3u) & ~3u) // blocks are 4 byte aligned
+#define MESH_SLAB_END 0xFFFF
+
+typedef struct {
+    uint8_t* memory;                // block_count * block_size bytes
+    uint16_t* links;                // free list, next free block of each free block
+    uint16_t block_size;
+    uint16_t block_count;
+    _Atomic uint32_t free_head;     // | 16 bit tag | 16 bit block index |, tag changes on every update so a stale head never matches
+    _Atomic uint32_t in_use;
+    _Atomic uint32_t high_water;    // most blocks in use at once since init
+    _Atomic uint32_t failures;      // allocs refused because the pool was empty
+} mesh_slab_t;
+
+typedef struct {
+    uint16_t block_size;
+    uint16_t block_count;
+    uint16_t in_use;
+    uint16_t high_water;
+    uint32_t failures;
+} mesh_slab_stats_t;
+
+/**
+ * @brief Initialize the pool on the provided storage, every block free.
+ * 
+ * @param slab Pointer to the pool.
+ * @param memory Pointer to 4 byte aligned storage of block_count * block_size bytes.
+ * @param links Pointer to block_count links.
+ * @param block_size Size of one block, a multiple of 4 (MESH_SLAB_BLOCK_SIZE()).
+ * @param block_count Number of blocks, less than MESH_SLAB_END.
+ */
+void mesh_slab_init(mesh_slab_t* slab, uint8_t* memory, uint16_t* links, uint16_t block_size, uint16_t block_count);
+
+/**
+ * @brief Take a block.
+ * 
+ * @param slab Pointer to the pool.
+ * @return Pointer to block_size bytes, NULL right away if every block is in use.
+ */
+void* mesh_slab_alloc(mesh_slab_t* slab);
+
+/**
+ * @brief Return a block taken with mesh_slab_alloc().
+ * 
+ * @param slab Pointer to the pool the block belongs to.
+ * @param block Pointer to the block, NULL is ignored.
+ */
+void mesh_slab_free(mesh_slab_t* slab, void* block);
+
+/**
+ * @brief Check if a pointer is a block of the pool.
+ * 
+ * @param slab Pointer to the pool.
+ * @param block Pointer to check.
+ * @return true if block was handed out by this pool.
+ */
+bool mesh_slab_owns(const mesh_slab_t* slab, const void* block);
+
+/**
+ * @brief Get usage of the pool.
+ * 
+ * @param slab Pointer to the pool.
+ * @param stats Out, usage, high water mark and refused allocs.
+ */
+void mesh_slab_get_stats(mesh_slab_t* slab, mesh_slab_stats_t* stats);
+
+#endif /* _MESH_SLAB_H_ */
@@ -0,0 +1,123 @@
+/* mesh_wheel.c - Hashed timer wheel for retransmit scheduling */
+
+#include "mesh_wheel.h"
+
+void mesh_wheel_init(mesh_wheel_t* wheel, uint16_t* slots, uint16_t slot_count, mesh_wheel_entry_t* entries, uint16_t entry_count) {
+    wheel->slots = slots;
+    wheel->entries = entries;
+    wheel->slot_count = slot_count;
+    wheel->entry_count = entry_count;
+    wheel->cursor = 0;
+    wheel->due_head = MESH_WHEEL_NONE;
+    wheel->due_tail = MESH_WHEEL_NONE;
+    wheel->pending = 0;
+
+    for (uint16_t i = 0; i < slot_count; i++) {
+        slots[i] = MESH_WHEEL_NONE;
+    }
+    for (uint16_t i = 0; i < entry_count; i++) {
+        entries[i].next = MESH_WHEEL_NONE;
+        entries[i].prev = MESH_WHEEL_NONE;
+        entries[i].slot = MESH_WHEEL_NONE;
+        entries[i].rounds = 0;
+    }
+}
+
+static void wheel_append_due(mesh_wheel_t* wheel, uint16_t index) {
+    mesh_wheel_entry_t* entry = &wheel->entries[index];
+
+    entry->slot = MESH_WHEEL_DUE;
+    entry->next = MESH_WHEEL_NONE;
+    entry->prev = wheel->due_tail;
+    if (wheel->due_tail != MESH_WHEEL_NONE) {
+        wheel->entries[wheel->due_tail].next = index;
+    } else {
+        wheel->due_head = index;
+    }
+    wheel->due_tail = index;
+}
+
+// unlink from its slot or the due list, entry keeps its slot field
+static void wheel_unlink(mesh_wheel_t* wheel, uint16_t index) {
+    mesh_wheel_entry_t* entry = &wheel->entries[index];
+
+    if (entry->prev != MESH_WHEEL_NONE) {
+        wheel->entries[entry->prev].next = entry->next;
+    } else if (entry->slot == MESH_WHEEL_DUE) {
+        wheel->due_head = entry->next;
+    } else {
+        wheel->slots[entry->slot] = entry->next;
+    }
+
+    if (entry->next != MESH_WHEEL_NONE) {
+        wheel->entries[entry->next].prev = entry->prev;
+    } else if (entry->slot == MESH_WHEEL_DUE) {
+        wheel->due_tail = entry->prev;
+    }
+}
+
+void mesh_wheel_schedule(mesh_wheel_t* wheel, uint16_t index, uint32_t ticks) {
+    mesh_wheel_cancel(wheel, index);
+    wheel->pending++;
+
+    if (ticks == 0) {
+        wheel_append_due(wheel, index);
+        return;
+    }
+
+    // visited first after (ticks - 1) % slot_count + 1 advances, then once per turn
+    mesh_wheel_entry_t* entry = &wheel->entries[index];
+    uint16_t slot = (wheel->cursor + ticks) % wheel->slot_count;
+    entry->slot = slot;
+    entry->rounds = (ticks - 1) / wheel->slot_count;
+    entry->prev = MESH_WHEEL_NONE;
+    entry->next = wheel->slots[slot];
+    if (entry->next != MESH_WHEEL_NONE) {
+        wheel->entries[entry->next].prev = index;
+    }
+    wheel->slots[slot] = index;
+}
+
+void mesh_wheel_cancel(mesh_wheel_t* wheel, uint16_t index) {
+    mesh_wheel_entry_t* entry = &wheel->entries[index];
+
+    if (entry->slot == MESH_WHEEL_NONE) {
+        return;
+    }
+    wheel_unlink(wheel, index);
+    entry->slot = MESH_WHEEL_NONE;
+    entry->next = MESH_WHEEL_NONE;
+    entry->prev = MESH_WHEEL_NONE;
+    wheel->pending--;
+}
+
+void mesh_wheel_advance(mesh_wheel_t* wheel) {
+    wheel->cursor = (wheel->cursor + 1) % wheel->slot_count;
+
+    uint16_t index = wheel->slots[wheel->cursor];
+    while (index != MESH_WHEEL_NONE) {
+        mesh_wheel_entry_t* entry = &wheel->entries[index];
+        uint16_t next = entry->next;
+
+        if (entry->rounds > 0) {
+            entry->rounds--;
+        } else {
+            wheel_unlink(wheel, index);
+            wheel_append_due(wheel, index);
+        }
+        index = next;
+    }
+}
+
+uint16_t mesh_wheel_pop_due(mesh_wheel_t* wheel) {
+    uint16_t index = wheel->due_head;
+
+    if (index != MESH_WHEEL_NONE) {
+        mesh_wheel_cancel(wheel, index);
+    }
+    return index;
+}
+
+uint16_t mesh_wheel_pending(const mesh_wheel_t* wheel) {
+    return wheel->pending;
+}
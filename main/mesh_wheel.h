@@ -0,0 +1,84 @@
+/* mesh_wheel.h - Hashed timer wheel for retransmit scheduling */
+
+// entries are indexes into a caller table, each one in at most one slot, schedule and cancel are O(1)
+// the caller drives the wheel one tick at a time (esp_timer on target) and serializes access itself
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _MESH_WHEEL_H_
+#define _MESH_WHEEL_H_
+
+#define MESH_WHEEL_NONE 0xFFFF // end of list, entry not scheduled
+#define MESH_WHEEL_DUE  0xFFFE // slot of entries that expired and were not popped yet
+
+typedef struct {
+    uint16_t next;
+    uint16_t prev;
+    uint16_t slot;      // slot index, MESH_WHEEL_DUE or MESH_WHEEL_NONE
+    uint16_t rounds;    // full turns of the wheel left before the entry expires
+} mesh_wheel_entry_t;
+
+typedef struct {
+    uint16_t* slots;            // slot_count list heads
+    mesh_wheel_entry_t* entries;
+    uint16_t slot_count;
+    uint16_t entry_count;
+    uint16_t cursor;            // slot of the current tick
+    uint16_t due_head;          // expired entries in expiry order, kept across ticks until popped
+    uint16_t due_tail;
+    uint16_t pending;           // entries scheduled or due
+} mesh_wheel_t;
+
+/**
+ * @brief Initialize the wheel on the provided storage, no entry scheduled.
+ *
+ * @param wheel Pointer to the wheel.
+ * @param slots Pointer to slot_count list heads.
+ * @param slot_count Number of slots, one tick each, a full turn is slot_count ticks.
+ * @param entries Pointer to entry_count entries, parallel to the caller table.
+ * @param entry_count Number of entries, less than MESH_WHEEL_DUE.
+ */
+void mesh_wheel_init(mesh_wheel_t* wheel, uint16_t* slots, uint16_t slot_count, mesh_wheel_entry_t* entries, uint16_t entry_count);
+
+/**
+ * @brief Schedule an entry, an entry already scheduled or due is moved.
+ *
+ * @param wheel Pointer to the wheel.
+ * @param index Entry index.
+ * @param ticks Ticks from now, 0 makes the entry due right away.
+ */
+void mesh_wheel_schedule(mesh_wheel_t* wheel, uint16_t index, uint32_t ticks);
+
+/**
+ * @brief Remove an entry from the wheel, nothing done if it is not scheduled.
+ *
+ * @param wheel Pointer to the wheel.
+ * @param index Entry index.
+ */
+void mesh_wheel_cancel(mesh_wheel_t* wheel, uint16_t index);
+
+/**
+ * @brief Move the wheel one tick, entries of the new slot with no rounds left become due.
+ *
+ * @param wheel Pointer to the wheel.
+ */
+void mesh_wheel_advance(mesh_wheel_t* wheel);
+
+/**
+ * @brief Take the oldest due entry, entries not taken stay due for the next call.
+ *
+ * @param wheel Pointer to the wheel.
+ * @return Entry index, MESH_WHEEL_NONE if no entry is due.
+ */
+uint16_t mesh_wheel_pop_due(mesh_wheel_t* wheel);
+
+/**
+ * @brief Get the number of entries scheduled or due, the driver may stop ticking at 0.
+ *
+ * @param wheel Pointer to the wheel.
+ * @return Pending entries.
+ */
+uint16_t mesh_wheel_pending(const mesh_wheel_t* wheel);
+
+#endif /* _MESH_WHEEL_H_ */
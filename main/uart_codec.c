@@ -0,0 +1,262 @@
+/* uart_codec.c - Host link frame encoding and streaming decoding */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include "esp_log.h"
+#include "uart_codec.h"
+
+#define TAG_C "CODEC"
+
+// escape char, encode the whole block into the output buffer without touching the uart driver
+// encoded buffer need to hold at least 2 * length bytes (worst case every byte escaped)
+size_t uart_encode_bytes(const uint8_t* data, size_t length, uint8_t* encoded) {
+    uint8_t* encode_itr = encoded;
+
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        if (byte_itr[0] < ESCAPE_BYTE) {
+            *encode_itr++ = byte_itr[0];
+            continue;
+        }
+
+        // need 2 byte encoded
+        *encode_itr++ = ESCAPE_BYTE;
+        *encode_itr++ = byte_itr[0] ^ ESCAPE_BYTE; // bitwise Xor
+    }
+
+    return encode_itr - encoded;
+}
+
+int uart_encode_frame(uint16_t node_addr, const uint8_t* data, size_t length, uint8_t* frame, size_t frame_size) {
+    // size check on worst case, every byte of address and payload escaped
+    if (UART_FRAME_MAX_LEN(length) > frame_size) {
+        return -1;
+    }
+
+    uint16_t node_addr_network_endian = htons(node_addr);
+    uint8_t* frame_itr = frame;
+
+    *frame_itr++ = UART_START; // 0xFF
+    frame_itr += uart_encode_bytes((uint8_t*) &node_addr_network_endian, 2, frame_itr);
+    frame_itr += uart_encode_bytes(data, length, frame_itr);
+    *frame_itr++ = UART_END;   // 0xFE
+
+    return frame_itr - frame;
+}
+
+void uart_seq_trailer(uint16_t node_addr, uint8_t seq, const uint8_t* data, size_t length, uint8_t* trailer) {
+    uint16_t node_addr_network_endian = htons(node_addr);
+
+    uint16_t crc = uart_crc16((uint8_t*) &node_addr_network_endian, 2, UART_CRC16_INIT);
+    crc = uart_crc16(data, length, crc);
+    crc = uart_crc16(&seq, 1, crc);
+    trailer[0] = seq;
+    trailer[1] = crc >> 8;
+    trailer[2] = crc & 0xFF;
+}
+
+int uart_encode_seq_frame(uint16_t node_addr, uint8_t seq, const uint8_t* data, size_t length, uint8_t* frame, size_t frame_size) {
+    if (UART_FRAME_MAX_LEN(length + UART_SEQ_TRAILER_LEN) > frame_size) {
+        return -1;
+    }
+
+    uint16_t node_addr_network_endian = htons(node_addr);
+    uint8_t trailer[UART_SEQ_TRAILER_LEN];
+    uint8_t* frame_itr = frame;
+
+    uart_seq_trailer(node_addr, seq, data, length, trailer);
+
+    *frame_itr++ = UART_START; // 0xFF
+    frame_itr += uart_encode_bytes((uint8_t*) &node_addr_network_endian, 2, frame_itr);
+    frame_itr += uart_encode_bytes(data, length, frame_itr);
+    frame_itr += uart_encode_bytes(trailer, UART_SEQ_TRAILER_LEN, frame_itr);
+    *frame_itr++ = UART_END;   // 0xFE
+
+    return frame_itr - frame;
+}
+
+typedef struct {
+    uint8_t* out;       // next data byte
+    uint8_t* code_ptr;  // code byte of the current block, written once the block ends
+    uint8_t code;       // current block length + 1
+} uart_cobs_encoder_t;
+
+// COBS over several blocks of content, every output byte xor with UART_END
+static void uart_cobs_put(uart_cobs_encoder_t* encoder, const uint8_t* data, size_t length) {
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        if (byte_itr[0] != 0) {
+            *encoder->out++ = byte_itr[0] ^ UART_END;
+            if (++encoder->code != 0xFF) {
+                continue;
+            }
+            // 254 bytes without zero, close the block without implied zero
+        }
+
+        *encoder->code_ptr = encoder->code ^ UART_END;
+        encoder->code_ptr = encoder->out++;
+        encoder->code = 1;
+    }
+}
+
+int uart_encode_cobs_frame(uint16_t node_addr, const uint8_t* data, size_t length, const uint8_t* trailer, size_t trailer_length, uint8_t* frame, size_t frame_size) {
+    if (UART_COBS_FRAME_MAX_LEN(2 + length + trailer_length) > frame_size) {
+        return -1;
+    }
+
+    uint16_t node_addr_network_endian = htons(node_addr);
+    uart_cobs_encoder_t encoder = {
+        .out = frame + 1,
+        .code_ptr = frame,
+        .code = 1,
+    };
+
+    uart_cobs_put(&encoder, (uint8_t*) &node_addr_network_endian, 2);
+    uart_cobs_put(&encoder, data, length);
+    if (trailer_length > 0) {
+        uart_cobs_put(&encoder, trailer, trailer_length);
+    }
+    *encoder.code_ptr = encoder.code ^ UART_END;
+    *encoder.out++ = UART_END; // 0xFE
+
+    return encoder.out - frame;
+}
+
+// table-less CRC-16/CCITT-FALSE, a few shifts per byte
+uint16_t uart_crc16(const uint8_t* data, size_t length, uint16_t crc) {
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        crc = (crc >> 8) | (crc << 8);
+        crc ^= byte_itr[0];
+        crc ^= (crc & 0xFF) >> 4;
+        crc ^= crc << 12;
+        crc ^= (crc & 0xFF) << 5;
+    }
+    return crc;
+}
+
+void uart_decoder_init(uart_decoder_t* decoder, uint8_t* buffer, size_t buffer_size) {
+    decoder->buffer = buffer;
+    decoder->buffer_size = buffer_size;
+    decoder->length = 0;
+    decoder->in_frame = false;
+    decoder->escaped = false;
+    decoder->cobs = false;
+    decoder->dropping = false;
+    decoder->cobs_code = 0xFF;
+    decoder->cobs_remaining = 0;
+}
+
+void uart_decoder_set_mode(uart_decoder_t* decoder, uint8_t link_mode) {
+    bool cobs = (link_mode & UART_LINK_MODE_COBS);
+    if (decoder->cobs == cobs) {
+        return;
+    }
+
+    uart_decoder_init(decoder, decoder->buffer, decoder->buffer_size);
+    decoder->cobs = cobs;
+}
+
+static void uart_decoder_feed_escaped(uart_decoder_t* decoder, const uint8_t* data, size_t length, void (*frame_handler)(uint8_t* frame, size_t length)) {
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        uint8_t byte = byte_itr[0];
+
+        if (byte == UART_START) {
+            if (decoder->in_frame && decoder->length > 0) {
+                ESP_LOGW(TAG_C, "Dropped unterminated frame with %zu bytes", decoder->length);
+            }
+            // located start of message
+            decoder->in_frame = true;
+            decoder->escaped = false;
+            decoder->length = 0;
+            continue;
+        }
+
+        if (!decoder->in_frame) {
+            continue; // noise between frames
+        }
+
+        if (byte == UART_END) {
+            // located end of message, message at least 1 byte
+            decoder->in_frame = false;
+            if (decoder->length > 0) {
+                frame_handler(decoder->buffer, decoder->length);
+            }
+            decoder->length = 0;
+            continue;
+        }
+
+        if (byte == ESCAPE_BYTE) {
+            // ESCAPE_BYTE, decode next byte
+            decoder->escaped = true;
+            continue;
+        }
+
+        if (decoder->escaped) {
+            byte ^= ESCAPE_BYTE; // bitwise Xor
+            decoder->escaped = false;
+        }
+
+        if (decoder->length >= decoder->buffer_size) {
+            ESP_LOGE(TAG_C, "Frame exceeds %zu bytes decode buffer, dropped", decoder->buffer_size);
+            decoder->in_frame = false;
+            decoder->length = 0;
+            continue;
+        }
+        decoder->buffer[decoder->length++] = byte;
+    }
+}
+
+// COBS frame has no start byte, everything after an end byte belongs to the next frame
+static void uart_decoder_feed_cobs(uart_decoder_t* decoder, const uint8_t* data, size_t length, void (*frame_handler)(uint8_t* frame, size_t length)) {
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        uint8_t byte = byte_itr[0];
+
+        if (byte == UART_END) {
+            // block left open means bytes lost in the middle
+            if (decoder->in_frame && !decoder->dropping && decoder->cobs_remaining == 0 && decoder->length > 0) {
+                frame_handler(decoder->buffer, decoder->length);
+            } else if (decoder->in_frame) {
+                ESP_LOGW(TAG_C, "Dropped malformed cobs frame with %zu bytes", decoder->length);
+            }
+            decoder->in_frame = false;
+            decoder->dropping = false;
+            decoder->length = 0;
+            decoder->cobs_code = 0xFF;
+            decoder->cobs_remaining = 0;
+            continue;
+        }
+
+        decoder->in_frame = true;
+        if (decoder->dropping) {
+            continue;
+        }
+
+        byte ^= UART_END;
+        if (decoder->cobs_remaining == 0) {
+            // code byte, previous block end with an implied zero unless it was a full 254 byte block
+            bool implied_zero = (decoder->cobs_code != 0xFF);
+            decoder->cobs_code = byte;
+            decoder->cobs_remaining = byte - 1;
+            if (!implied_zero) {
+                continue;
+            }
+            byte = 0;
+        } else {
+            decoder->cobs_remaining--;
+        }
+
+        if (decoder->length >= decoder->buffer_size) {
+            ESP_LOGE(TAG_C, "Frame exceeds %zu bytes decode buffer, dropped", decoder->buffer_size);
+            decoder->dropping = true;
+            continue;
+        }
+        decoder->buffer[decoder->length++] = byte;
+    }
+}
+
+// Decode on the fly, frame state is kept in decoder so a frame can be split across any number of reads
+void uart_decoder_feed(uart_decoder_t* decoder, const uint8_t* data, size_t length, void (*frame_handler)(uint8_t* frame, size_t length)) {
+    if (decoder->cobs) {
+        uart_decoder_feed_cobs(decoder, data, length, frame_handler);
+    } else {
+        uart_decoder_feed_escaped(decoder, data, length, frame_handler);
+    }
+}
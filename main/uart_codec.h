@@ -0,0 +1,144 @@
+/* uart_codec.h - Host link frame encoding and streaming decoding */
+
+// pure C without driver or RTOS dependency, shared by the firmware and the host harness in /host
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef _UART_CODEC_H_
+#define _UART_CODEC_H_
+
+#define ESCAPE_BYTE 0xFA
+#define UART_START 0xFF
+#define UART_END 0xFE
+
+// worst case encoded frame size, start byte + escaped (2 byte addr + payload) + end byte
+#define UART_FRAME_MAX_LEN(payload_len) (2 + 2 * (2 + (payload_len)))
+
+#define UART_LINK_FLAG_HW_FLOW_CTRL 0x01 // BAUD- flag byte and UART_MSG_LINK_STATUS flags
+
+// framing mode on the host link, set by host with LINK- command
+#define UART_LINK_MODE_PLAIN    0x00
+#define UART_LINK_MODE_SEQ      0x01 // every frame end with | seq | crc16 |, host frames are acked with a sliding window
+#define UART_LINK_MODE_COBS     0x02 // COBS framing instead of escape byte, at most 1 byte overhead per 254
+
+#define UART_SEQ_TRAILER_LEN 3  // | 1 byte seq | 2 byte crc16 (network order) |, crc cover frame content and seq
+#define UART_CRC16_INIT 0xFFFF  // CRC-16/CCITT-FALSE, poly 0x1021
+
+// COBS frame, | cobs(content) ^ 0xFE | 0xFE |, xor keep the end byte out of the frame so pattern detection still works
+#define UART_COBS_FRAME_MAX_LEN(content_len) ((content_len) + (content_len) / 254 + 2)
+
+typedef struct {
+    uint8_t* buffer;    // decoded content of the current frame
+    size_t buffer_size;
+    size_t length;      // decoded bytes of the current frame so far
+    bool in_frame;      // start byte seen, waiting for end byte
+    bool escaped;       // last byte was ESCAPE_BYTE
+    bool cobs;          // frame with COBS instead of escape byte
+    bool dropping;      // COBS frame too long or malformed, skip to the next end byte
+    uint8_t cobs_code;      // code byte of the current COBS block
+    uint8_t cobs_remaining; // data bytes left in the current COBS block
+} uart_decoder_t;
+
+/**
+ * @brief Encode bytes with escape byte into the provided buffer.
+ * 
+ * @param data Pointer to the data to be encoded.
+ * @param length Length of the data.
+ * @param encoded Pointer to the output buffer, must hold at least 2 * length bytes.
+ * @return Length of the encoded data.
+ */
+size_t uart_encode_bytes(const uint8_t* data, size_t length, uint8_t* encoded);
+
+/**
+ * @brief Encode a complete uart frame (start byte, node address, payload, end byte) into a contiguous buffer.
+ * 
+ * @param node_addr Node address associated with the payload.
+ * @param data Pointer to the payload.
+ * @param length Length of the payload.
+ * @param frame Pointer to the output buffer.
+ * @param frame_size Size of the output buffer, must hold UART_FRAME_MAX_LEN(length) bytes.
+ * @return Length of the encoded frame, -1 if the output buffer is too small.
+ */
+int uart_encode_frame(uint16_t node_addr, const uint8_t* data, size_t length, uint8_t* frame, size_t frame_size);
+
+/**
+ * @brief Encode a uart frame with seq and crc16 trailer, frame format of UART_LINK_MODE_SEQ.
+ * 
+ * @param node_addr Node address associated with the payload.
+ * @param seq Sequence number of the frame.
+ * @param data Pointer to the payload.
+ * @param length Length of the payload.
+ * @param frame Pointer to the output buffer.
+ * @param frame_size Size of the output buffer, must hold UART_FRAME_MAX_LEN(length + UART_SEQ_TRAILER_LEN) bytes.
+ * @return Length of the encoded frame, -1 if the output buffer is too small.
+ */
+int uart_encode_seq_frame(uint16_t node_addr, uint8_t seq, const uint8_t* data, size_t length, uint8_t* frame, size_t frame_size);
+
+/**
+ * @brief Encode a uart frame with COBS, frame format of UART_LINK_MODE_COBS.
+ * 
+ * @param node_addr Node address associated with the payload.
+ * @param data Pointer to the payload.
+ * @param length Length of the payload.
+ * @param trailer Pointer to bytes appended after the payload (seq trailer), NULL if none.
+ * @param trailer_length Length of the trailer.
+ * @param frame Pointer to the output buffer.
+ * @param frame_size Size of the output buffer, must hold UART_COBS_FRAME_MAX_LEN(2 + length + trailer_length) bytes.
+ * @return Length of the encoded frame, -1 if the output buffer is too small.
+ */
+int uart_encode_cobs_frame(uint16_t node_addr, const uint8_t* data, size_t length, const uint8_t* trailer, size_t trailer_length, uint8_t* frame, size_t frame_size);
+
+/**
+ * @brief Build the seq trailer (| seq | crc16 |) of a root frame.
+ * 
+ * @param node_addr Node address associated with the payload.
+ * @param seq Sequence number of the frame.
+ * @param data Pointer to the payload.
+ * @param length Length of the payload.
+ * @param trailer Output, UART_SEQ_TRAILER_LEN bytes.
+ */
+void uart_seq_trailer(uint16_t node_addr, uint8_t seq, const uint8_t* data, size_t length, uint8_t* trailer);
+
+/**
+ * @brief Compute CRC-16/CCITT-FALSE, can be chained over several blocks.
+ * 
+ * @param data Pointer to the data.
+ * @param length Length of the data.
+ * @param crc UART_CRC16_INIT on the first block, result of the previous block otherwise.
+ * @return Updated crc.
+ */
+uint16_t uart_crc16(const uint8_t* data, size_t length, uint16_t crc);
+
+/**
+ * @brief Initialize a streaming uart frame decoder.
+ * 
+ * @param decoder Pointer to the decoder state.
+ * @param buffer Pointer to the buffer holding the decoded frame.
+ * @param buffer_size Size of the buffer, longer frames are dropped.
+ */
+void uart_decoder_init(uart_decoder_t* decoder, uint8_t* buffer, size_t buffer_size);
+
+/**
+ * @brief Switch the decoder between escape byte and COBS framing, partial frame is dropped on change.
+ * 
+ * @param decoder Pointer to the decoder state.
+ * @param link_mode Link mode, see UART_LINK_MODE_COBS.
+ */
+void uart_decoder_set_mode(uart_decoder_t* decoder, uint8_t link_mode);
+
+/**
+ * @brief Feed received bytes into the decoder.
+ * 
+ *  Escape or COBS decoding is done on the fly and partial frame state is kept across calls,
+ *  frame_handler is invoked once for every complete frame found.
+ * 
+ * @param decoder Pointer to the decoder state.
+ * @param data Pointer to the received bytes.
+ * @param length Number of received bytes.
+ * @param frame_handler Callback invoked with the decoded frame content (without start and end byte).
+ */
+void uart_decoder_feed(uart_decoder_t* decoder, const uint8_t* data, size_t length, void (*frame_handler)(uint8_t* frame, size_t length));
+
+#endif /* _UART_CODEC_H_ */
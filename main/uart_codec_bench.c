@@ -0,0 +1,84 @@
+/* uart_codec_bench.c - On-target throughput benchmark of the uart framing modes */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "board.h"
+#include "uart_codec_bench.h"
+
+#define TAG_BENCH "BENCH"
+
+static uint8_t bench_payload[UART_BENCH_PAYLOAD_LEN];
+static uint8_t bench_frame[UART_FRAME_MAX_LEN(UART_BENCH_PAYLOAD_LEN)];
+static uint8_t bench_decoded[UART_BENCH_PAYLOAD_LEN + 2];
+static size_t bench_decoded_frames = 0;
+
+static void bench_frame_handler(uint8_t* frame, size_t length) {
+    bench_decoded_frames++;
+}
+
+// kB/s from bytes processed and elapsed us
+static uint32_t bench_rate(size_t bytes, int64_t elapsed_us) {
+    return (elapsed_us > 0 ? (uint32_t) ((uint64_t) bytes * 1000 / elapsed_us) : 0);
+}
+
+static void bench_fill(const char* profile) {
+    uint32_t seed = 0x12345678;
+
+    for (int i = 0; i < UART_BENCH_PAYLOAD_LEN; i++) {
+        if (strcmp(profile, "ascii") == 0) {
+            bench_payload[i] = 'a' + i % 26; // text sensor report
+        } else if (strcmp(profile, "binary") == 0) {
+            seed = seed * 1664525 + 1013904223; // LCG, uniform bytes
+            bench_payload[i] = seed >> 24;
+        } else {
+            bench_payload[i] = 0xFF; // worst case of escape byte framing
+        }
+    }
+}
+
+static void bench_run(const char* profile, bool cobs) {
+    uart_decoder_t decoder;
+    char report[128];
+    int frame_len = 0;
+
+    // encode
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < UART_BENCH_ITERATIONS; i++) {
+        if (cobs) {
+            frame_len = uart_encode_cobs_frame(1, bench_payload, UART_BENCH_PAYLOAD_LEN, NULL, 0, bench_frame, sizeof(bench_frame));
+        } else {
+            frame_len = uart_encode_frame(1, bench_payload, UART_BENCH_PAYLOAD_LEN, bench_frame, sizeof(bench_frame));
+        }
+    }
+    int64_t encode_us = esp_timer_get_time() - start;
+
+    // decode
+    uart_decoder_init(&decoder, bench_decoded, sizeof(bench_decoded));
+    uart_decoder_set_mode(&decoder, cobs ? UART_LINK_MODE_COBS : UART_LINK_MODE_PLAIN);
+    bench_decoded_frames = 0;
+    start = esp_timer_get_time();
+    for (int i = 0; i < UART_BENCH_ITERATIONS; i++) {
+        uart_decoder_feed(&decoder, bench_frame, frame_len, bench_frame_handler);
+    }
+    int64_t decode_us = esp_timer_get_time() - start;
+
+    size_t payload_bytes = (size_t) UART_BENCH_PAYLOAD_LEN * UART_BENCH_ITERATIONS;
+    snprintf(report, sizeof(report), "[Bench] %s %s: frame %d/%d bytes, encode %" PRIu32 " kB/s, decode %" PRIu32 " kB/s, %d frames ok\n",
+             cobs ? "cobs  " : "escape", profile, frame_len, UART_BENCH_PAYLOAD_LEN,
+             bench_rate(payload_bytes, encode_us), bench_rate(payload_bytes, decode_us), bench_decoded_frames);
+    ESP_LOGI(TAG_BENCH, "%s", report);
+    uart_sendMsg(0, report);
+}
+
+void uart_codec_benchmark(void) {
+    static const char* profiles[] = { "ascii", "binary", "0xff" };
+
+    for (int i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        bench_fill(profiles[i]);
+        bench_run(profiles[i], false);
+        bench_run(profiles[i], true);
+    }
+}
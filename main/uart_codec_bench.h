@@ -0,0 +1,16 @@
+/* uart_codec_bench.h - On-target throughput benchmark of the uart framing modes */
+
+#ifndef _UART_CODEC_BENCH_H_
+#define _UART_CODEC_BENCH_H_
+
+#define UART_BENCH_PAYLOAD_LEN 256
+#define UART_BENCH_ITERATIONS 200
+
+/**
+ * @brief Benchmark escape byte framing against COBS framing, encode and decode, on a few payload profiles.
+ * 
+ *  Results are sent to host as text messages on node address 0, takes a few hundred ms and blocks the caller.
+ */
+void uart_codec_benchmark(void);
+
+#endif /* _UART_CODEC_BENCH_H_ */
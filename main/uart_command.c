@@ -0,0 +1,401 @@
+/* uart_command.c - Parse and dispatch network commands received from host */
+
+#include <string.h>
+#include <arpa/inet.h> // for host byte endianess <--> network byte endianess convert
+#include "esp_log.h"
+#include "uart_codec.h"
+#include "uart_command.h"
+
+#define TAG_E "EXE"
+
+typedef struct {
+    uint64_t key;   // 5 byte verb packed, 0 marks an empty slot
+    uart_command_handler_t handler;
+    uint8_t command_class;
+} uart_command_entry_t;
+
+static const uart_command_ops_t* command_ops = NULL;
+static uint16_t command_node_addrs[CMD_MAX_NODE_ADDRS]; // node addresses of the command being executed, host order
+static uart_command_entry_t command_table[UART_COMMAND_TABLE_SIZE];
+static size_t command_count = 0;
+
+// verbs are printable ascii, so a packed verb is never 0
+static inline uint64_t command_key(const char* verb) {
+    const uint8_t* bytes = (const uint8_t*) verb;
+    return ((uint64_t) bytes[0] << 32) | ((uint64_t) bytes[1] << 24) | ((uint64_t) bytes[2] << 16) |
+           ((uint64_t) bytes[3] << 8) | bytes[4];
+}
+
+// fibonacci hashing, top bits of the product spread the similar verbs over the table
+static inline size_t command_slot(uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> (64 - UART_COMMAND_TABLE_BITS);
+}
+
+static void reply_msg(char* msg) {
+    command_ops->reply(0, (uint8_t*) msg, strlen(msg));
+}
+
+// read network order addresses into command_node_addrs
+static void load_node_addrs(const uint8_t* addrs, size_t node_count) {
+    for (size_t i = 0; i < node_count; i++) {
+        uint16_t node_addr_network_order = 0;
+        memcpy(&node_addr_network_order, addrs + i * CMD_NODE_ADDR_LEN, CMD_NODE_ADDR_LEN);
+        command_node_addrs[i] = ntohs(node_addr_network_order);
+    }
+}
+
+// ======================== Built-in Commands ========================
+static void command_net_info(uint8_t* payload, size_t length) {
+    command_ops->send_network_info();
+}
+
+static void command_pool_stats(uint8_t* payload, size_t length) {
+    command_ops->send_pool_stats();
+}
+
+// | optional action |
+static void command_outbox(uint8_t* payload, size_t length) {
+    uint8_t action = (length >= CMD_OUTBOX_ACTION_LEN ? payload[0] : CMD_OUTBOX_LIST);
+    if (action > CMD_OUTBOX_CLEAR) {
+        reply_msg("Error: Invalid Outbox Action\n");
+        return;
+    }
+    command_ops->outbox(action);
+}
+
+// | 4 byte epoch | 4 byte version |, both 0 on first poll
+static void command_net_delta(uint8_t* payload, size_t length) {
+    if (length < CMD_TOPOLOGY_EPOCH_LEN + CMD_TOPOLOGY_VERSION_LEN) {
+        reply_msg("Error: No Topology Version Attached\n");
+        return;
+    }
+
+    uint32_t epoch_network_order = 0;
+    uint32_t version_network_order = 0;
+    memcpy(&epoch_network_order, payload, CMD_TOPOLOGY_EPOCH_LEN);
+    memcpy(&version_network_order, payload + CMD_TOPOLOGY_EPOCH_LEN, CMD_TOPOLOGY_VERSION_LEN);
+    command_ops->send_network_delta(ntohl(epoch_network_order), ntohl(version_network_order));
+}
+
+// | 2 byte cursor | 2 byte field mask | optional max node amount |
+static void command_query_nodes(uint8_t* payload, size_t length) {
+    if (length < CMD_QUERY_CURSOR_LEN + CMD_QUERY_FIELDS_LEN) {
+        reply_msg("Error: No Cursor or Field Mask Attached\n");
+        return;
+    }
+
+    uint16_t cursor_network_order = 0;
+    uint16_t fields_network_order = 0;
+    memcpy(&cursor_network_order, payload, CMD_QUERY_CURSOR_LEN);
+    memcpy(&fields_network_order, payload + CMD_QUERY_CURSOR_LEN, CMD_QUERY_FIELDS_LEN);
+    uint8_t max_nodes = (length > CMD_QUERY_CURSOR_LEN + CMD_QUERY_FIELDS_LEN ? payload[CMD_QUERY_CURSOR_LEN + CMD_QUERY_FIELDS_LEN] : 0);
+    command_ops->send_node_query(ntohs(cursor_network_order), ntohs(fields_network_order), max_nodes);
+}
+
+static void command_send_message(uint8_t* payload, size_t length) {
+    if (length < CMD_NODE_ADDR_LEN) {
+        reply_msg("Error: No Dst Address Attached\n");
+        return;
+    } else if (length == CMD_NODE_ADDR_LEN) {
+        reply_msg("Error: No Message Attached\n");
+        return;
+    }
+
+    uint16_t node_addr_network_order = 0;
+    memcpy(&node_addr_network_order, payload, CMD_NODE_ADDR_LEN);
+    uint16_t node_addr = ntohs(node_addr_network_order);
+
+    ESP_LOGI(TAG_E, "Sending message to address-%d ...", node_addr);
+    command_ops->send_message(node_addr, length - CMD_NODE_ADDR_LEN, payload + CMD_NODE_ADDR_LEN);
+}
+
+// | 2 byte request id | flags | 2 byte node addr | message |, outcome reported with the request id
+static void command_send_tagged_message(uint8_t* payload, size_t length) {
+    size_t header_len = CMD_REQUEST_ID_LEN + CMD_SEND_FLAGS_LEN + CMD_NODE_ADDR_LEN;
+    if (length < header_len) {
+        reply_msg("Error: No Request Id or Dst Address Attached\n");
+        return;
+    } else if (length == header_len) {
+        reply_msg("Error: No Message Attached\n");
+        return;
+    }
+
+    uint16_t request_id_network_order = 0;
+    uint16_t node_addr_network_order = 0;
+    memcpy(&request_id_network_order, payload, CMD_REQUEST_ID_LEN);
+    uint8_t flags = payload[CMD_REQUEST_ID_LEN];
+    memcpy(&node_addr_network_order, payload + CMD_REQUEST_ID_LEN + CMD_SEND_FLAGS_LEN, CMD_NODE_ADDR_LEN);
+
+    command_ops->send_tagged_message(ntohs(request_id_network_order), ntohs(node_addr_network_order),
+        flags & CMD_SEND_FLAG_RESPONSE, length - header_len, payload + header_len);
+}
+
+// one payload to many nodes, | 1 byte node count | node count * 2 byte node addr | message |
+static void command_send_multi_message(uint8_t* payload, size_t length) {
+    if (length < CMD_NODE_COUNT_LEN || payload[0] == 0) {
+        reply_msg("Error: No Dst Address Attached\n");
+        return;
+    }
+
+    uint8_t node_count = payload[0];
+    if (node_count > CMD_MAX_MULTI_SEND_ADDRS) {
+        reply_msg("Error: Too Many Node Address\n");
+        return;
+    }
+    size_t addr_list_len = CMD_NODE_COUNT_LEN + node_count * CMD_NODE_ADDR_LEN;
+    if (length < addr_list_len) {
+        reply_msg("Error: Dst Address List Truncated\n");
+        return;
+    } else if (length == addr_list_len) {
+        reply_msg("Error: No Message Attached\n");
+        return;
+    }
+
+    load_node_addrs(payload + CMD_NODE_COUNT_LEN, node_count);
+    ESP_LOGI(TAG_E, "Sending message to %d nodes ...", node_count);
+    command_ops->send_multi_message(command_node_addrs, node_count, length - addr_list_len, payload + addr_list_len);
+}
+
+static void command_broadcast(uint8_t* payload, size_t length) {
+    if (length < CMD_NODE_ADDR_LEN) {
+        reply_msg("Error: No Message Attached\n");
+        return;
+    }
+
+    // 2 byte padding before message
+    command_ops->broadcast_message(length - CMD_NODE_ADDR_LEN, payload + CMD_NODE_ADDR_LEN);
+}
+
+// | 2 byte group addr | n * 2 byte node addr |
+static void command_group_members(uint8_t* payload, size_t length, bool add) {
+    if (length < CMD_GROUP_ADDR_LEN) {
+        reply_msg("Error: No Group Address Attached\n");
+        return;
+    }
+
+    uint16_t group_addr_network_order = 0;
+    memcpy(&group_addr_network_order, payload, CMD_GROUP_ADDR_LEN);
+    if ((length - CMD_GROUP_ADDR_LEN) % CMD_NODE_ADDR_LEN != 0) {
+        reply_msg("Error: Node Address List Malformed\n");
+        return;
+    }
+    size_t node_count = (length - CMD_GROUP_ADDR_LEN) / CMD_NODE_ADDR_LEN;
+    if (node_count > CMD_MAX_NODE_ADDRS) {
+        reply_msg("Error: Too Many Node Address\n");
+        return;
+    }
+
+    load_node_addrs(payload + CMD_GROUP_ADDR_LEN, node_count);
+    if (add) {
+        command_ops->add_group_members(ntohs(group_addr_network_order), command_node_addrs, node_count);
+    } else {
+        command_ops->delete_group_members(ntohs(group_addr_network_order), command_node_addrs, node_count);
+    }
+}
+
+static void command_group_add(uint8_t* payload, size_t length) {
+    if (length <= CMD_GROUP_ADDR_LEN) {
+        reply_msg("Error: No Node Address Attached\n");
+        return;
+    }
+    command_group_members(payload, length, true);
+}
+
+static void command_group_delete(uint8_t* payload, size_t length) {
+    command_group_members(payload, length, false);
+}
+
+static void command_group_send(uint8_t* payload, size_t length) {
+    if (length < CMD_GROUP_ADDR_LEN) {
+        reply_msg("Error: No Group Address Attached\n");
+        return;
+    } else if (length == CMD_GROUP_ADDR_LEN) {
+        reply_msg("Error: No Message Attached\n");
+        return;
+    }
+
+    uint16_t group_addr_network_order = 0;
+    memcpy(&group_addr_network_order, payload, CMD_GROUP_ADDR_LEN);
+    command_ops->send_group_message(ntohs(group_addr_network_order), length - CMD_GROUP_ADDR_LEN, payload + CMD_GROUP_ADDR_LEN);
+}
+
+// | 2 byte node addr | 4 byte total length |
+static void command_transfer_open(uint8_t* payload, size_t length) {
+    if (length < CMD_NODE_ADDR_LEN + CMD_TRANSFER_LENGTH_LEN) {
+        reply_msg("Error: No Dst Address or Length Attached\n");
+        return;
+    }
+
+    uint16_t node_addr_network_order = 0;
+    uint32_t total_length_network_order = 0;
+    memcpy(&node_addr_network_order, payload, CMD_NODE_ADDR_LEN);
+    memcpy(&total_length_network_order, payload + CMD_NODE_ADDR_LEN, CMD_TRANSFER_LENGTH_LEN);
+    command_ops->transfer_open(ntohs(node_addr_network_order), ntohl(total_length_network_order));
+}
+
+// | 4 byte offset | data |
+static void command_transfer_data(uint8_t* payload, size_t length) {
+    if (length < CMD_TRANSFER_OFFSET_LEN) {
+        reply_msg("Error: No Offset Attached\n");
+        return;
+    } else if (length == CMD_TRANSFER_OFFSET_LEN) {
+        reply_msg("Error: No Data Attached\n");
+        return;
+    }
+
+    uint32_t offset_network_order = 0;
+    memcpy(&offset_network_order, payload, CMD_TRANSFER_OFFSET_LEN);
+    command_ops->transfer_write(ntohl(offset_network_order), length - CMD_TRANSFER_OFFSET_LEN, payload + CMD_TRANSFER_OFFSET_LEN);
+}
+
+static void command_transfer_abort(uint8_t* payload, size_t length) {
+    command_ops->transfer_abort();
+}
+
+// | 2 byte node addr | ttl |
+static void command_set_node_ttl(uint8_t* payload, size_t length) {
+    if (length < CMD_NODE_ADDR_LEN + CMD_TTL_LEN) {
+        reply_msg("Error: No Dst Address or TTL Attached\n");
+        return;
+    }
+
+    uint16_t node_addr_network_order = 0;
+    memcpy(&node_addr_network_order, payload, CMD_NODE_ADDR_LEN);
+    command_ops->set_node_ttl(ntohs(node_addr_network_order), payload[CMD_NODE_ADDR_LEN]);
+}
+
+static void command_restart(uint8_t* payload, size_t length) {
+    command_ops->restart();
+}
+
+static void command_clean(uint8_t* payload, size_t length) {
+    reply_msg(" - Reseting Root Module\n");
+    command_ops->reset_network();
+}
+
+static void command_set_baud_rate(uint8_t* payload, size_t length) {
+    if (length < CMD_BAUD_RATE_LEN) {
+        reply_msg("Error: No Baud Rate Attached\n");
+        return;
+    }
+
+    uint32_t baud_rate_network_order = 0;
+    memcpy(&baud_rate_network_order, payload, CMD_BAUD_RATE_LEN);
+    // optional flag byte after baud rate
+    bool hw_flow_ctrl = (length > CMD_BAUD_RATE_LEN) && (payload[CMD_BAUD_RATE_LEN] & UART_LINK_FLAG_HW_FLOW_CTRL);
+    command_ops->request_baud_rate(ntohl(baud_rate_network_order), hw_flow_ctrl);
+}
+
+static void command_confirm_baud_rate(uint8_t* payload, size_t length) {
+    command_ops->confirm_baud_rate();
+}
+
+static void command_set_link_mode(uint8_t* payload, size_t length) {
+    if (length < CMD_LINK_MODE_LEN) {
+        reply_msg("Error: No Link Mode Attached\n");
+        return;
+    }
+    command_ops->set_link_mode(payload[0]);
+}
+
+// dev/debug use command
+static void command_benchmark(uint8_t* payload, size_t length) {
+    command_ops->benchmark();
+}
+
+// ======================== Dispatcher ========================
+// one hash and usually one probe, cost doesn't grow with the number of commands
+static const uart_command_entry_t* command_find(const char* verb) {
+    uint64_t key = command_key(verb);
+    for (size_t slot = command_slot(key); command_table[slot].key != 0; slot = (slot + 1) & (UART_COMMAND_TABLE_SIZE - 1)) {
+        if (command_table[slot].key == key) {
+            return &command_table[slot];
+        }
+    }
+    return NULL;
+}
+
+int uart_command_register(const char* verb, uart_command_handler_t handler, uint8_t command_class) {
+    uint64_t key = command_key(verb);
+
+    // keep at least one empty slot so a lookup of an unknown verb always terminates
+    if (command_count >= UART_COMMAND_TABLE_SIZE - 1) {
+        ESP_LOGE(TAG_E, "Command table full, can't register [%.*s]", CMD_LEN, verb);
+        return -1;
+    }
+
+    for (size_t slot = command_slot(key); ; slot = (slot + 1) & (UART_COMMAND_TABLE_SIZE - 1)) {
+        if (command_table[slot].key == key) {
+            ESP_LOGE(TAG_E, "Command [%.*s] already registered", CMD_LEN, verb);
+            return -1;
+        }
+        if (command_table[slot].key == 0) {
+            command_table[slot].key = key;
+            command_table[slot].handler = handler;
+            command_table[slot].command_class = command_class;
+            command_count++;
+            return 0;
+        }
+    }
+}
+
+void uart_command_init(const uart_command_ops_t* ops) {
+    command_ops = ops;
+    memset(command_table, 0, sizeof(command_table));
+    command_count = 0;
+
+    uart_command_register(CMD_GET_NET_INFO, command_net_info, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_GET_NET_DELTA, command_net_delta, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_QUERY_NODES, command_query_nodes, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_GET_POOL_STATS, command_pool_stats, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_OUTBOX, command_outbox, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_SEND_MSG, command_send_message, UART_COMMAND_BULK);
+    uart_command_register(CMD_TAGGED_SEND_MSG, command_send_tagged_message, UART_COMMAND_BULK);
+    uart_command_register(CMD_MULTI_SEND_MSG, command_send_multi_message, UART_COMMAND_BULK);
+    uart_command_register(CMD_BROADCAST_MSG, command_broadcast, UART_COMMAND_BULK);
+    uart_command_register(CMD_GROUP_ADD, command_group_add, UART_COMMAND_BULK);
+    uart_command_register(CMD_GROUP_DELETE, command_group_delete, UART_COMMAND_BULK);
+    uart_command_register(CMD_GROUP_SEND_MSG, command_group_send, UART_COMMAND_BULK);
+    uart_command_register(CMD_TRANSFER_OPEN, command_transfer_open, UART_COMMAND_BULK);
+    uart_command_register(CMD_TRANSFER_DATA, command_transfer_data, UART_COMMAND_BULK);
+    uart_command_register(CMD_TRANSFER_ABORT, command_transfer_abort, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_SET_NODE_TTL, command_set_node_ttl, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_RESET_ROOT, command_restart, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_CLEAN_NETWORK_CONFIG, command_clean, UART_COMMAND_CONTROL);
+    uart_command_register(CMD_SET_BAUD_RATE, command_set_baud_rate, UART_COMMAND_LINK);
+    uart_command_register(CMD_CONFIRM_BAUD_RATE, command_confirm_baud_rate, UART_COMMAND_LINK);
+    uart_command_register(CMD_SET_LINK_MODE, command_set_link_mode, UART_COMMAND_LINK);
+    uart_command_register(CMD_CODEC_BENCHMARK, command_benchmark, UART_COMMAND_BULK);
+}
+
+uint8_t uart_command_class(const uint8_t* frame, size_t length) {
+    if (length < CMD_LEN) {
+        return UART_COMMAND_CONTROL; // only an error reply
+    }
+
+    const uart_command_entry_t* entry = command_find((const char*) frame);
+    return (entry != NULL ? entry->command_class : UART_COMMAND_CONTROL);
+}
+
+void uart_command_execute(uint8_t* frame, size_t cmd_total_len) {
+    char* command = (char*) frame;
+
+    // ============= process and execute commands from net server (from uart) ==================
+    // uart command format | 5 byte command | payload |
+    if (cmd_total_len < CMD_LEN) {
+        ESP_LOGE(TAG_E, "Command [%.*s] with %zu byte too short", (int) cmd_total_len, command, cmd_total_len);
+        reply_msg("Error: Command Too Short\n");
+        return;
+    }
+
+    const uart_command_entry_t* entry = command_find(command);
+    if (entry != NULL) {
+        ESP_LOGI(TAG_E, "executing \'%.*s\'", CMD_LEN, command);
+        entry->handler(frame + CMD_LEN, cmd_total_len - CMD_LEN);
+        ESP_LOGI(TAG_E, "Command [%.*s] executed", (int) cmd_total_len, command);
+        return;
+    }
+
+    // ====== Not Supported  command ======
+    ESP_LOGE(TAG_E, "Command [%.*s] not Vaild", CMD_LEN, command);
+}
@@ -0,0 +1,139 @@
+/* uart_command.h - Parse and dispatch network commands received from host */
+
+// pure C, every side effect goes through uart_command_ops_t so the dispatcher also builds in /host
+// commands are resolved with a hash table on the 5 byte verb, modules add their own with uart_command_register()
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef _UART_COMMAND_H_
+#define _UART_COMMAND_H_
+
+#define CMD_LEN 5 // network command length - 5 byte
+#define CMD_GET_NET_INFO "NINFO"
+#define CMD_GET_NET_DELTA "NDELT"
+#define CMD_QUERY_NODES "NQURY"
+#define CMD_GET_POOL_STATS "POOLS"
+#define CMD_OUTBOX "OUTBX"
+#define CMD_SEND_MSG "SEND-"
+#define CMD_MULTI_SEND_MSG "MSEND"
+#define CMD_TAGGED_SEND_MSG "SENDT"
+#define CMD_BROADCAST_MSG "BCAST"
+#define CMD_GROUP_ADD "GRP-A"
+#define CMD_GROUP_DELETE "GRP-D"
+#define CMD_GROUP_SEND_MSG "GSEND"
+#define CMD_TRANSFER_OPEN "XOPEN"
+#define CMD_TRANSFER_DATA "XDATA"
+#define CMD_TRANSFER_ABORT "XABRT"
+#define CMD_SET_NODE_TTL "NTTL-"
+#define CMD_RESET_ROOT "RST-R"
+#define CMD_CLEAN_NETWORK_CONFIG "CLEAN"
+#define CMD_SET_BAUD_RATE "BAUD-"
+#define CMD_CONFIRM_BAUD_RATE "BAUDC"
+#define CMD_SET_LINK_MODE "LINK-"
+#define CMD_CODEC_BENCHMARK "BENCH"
+
+#define CMD_NODE_ADDR_LEN 2
+#define CMD_NODE_COUNT_LEN 1
+#define CMD_REQUEST_ID_LEN 2
+#define CMD_SEND_FLAGS_LEN 1
+#define CMD_SEND_FLAG_RESPONSE 0x01 // destination must respond, completion on response or timeout
+#define CMD_GROUP_ADDR_LEN 2
+#define CMD_MAX_NODE_ADDRS 255 // node addresses in one command
+#define CMD_MAX_MULTI_SEND_ADDRS 128 // node addresses in one MSEND, same as MESH_FANOUT_MAX_DST
+#define CMD_BAUD_RATE_LEN 4
+#define CMD_TOPOLOGY_EPOCH_LEN 4
+#define CMD_TOPOLOGY_VERSION_LEN 4
+#define CMD_QUERY_CURSOR_LEN 2
+#define CMD_QUERY_FIELDS_LEN 2
+#define CMD_TRANSFER_LENGTH_LEN 4
+#define CMD_TRANSFER_OFFSET_LEN 4
+#define CMD_TTL_LEN 1
+#define CMD_OUTBOX_ACTION_LEN 1
+#define CMD_OUTBOX_LIST 0x00  // report only, also when no action is given
+#define CMD_OUTBOX_SYNC 0x01  // write pending journal changes to nvs now
+#define CMD_OUTBOX_CLEAR 0x02 // drop every pending important message and its journal
+#define CMD_LINK_MODE_LEN 1
+
+// command classes, the rx task executes link commands itself and queues the others for the dispatch task
+#define UART_COMMAND_CONTROL 0  // network control and queries, overtake queued bulk commands
+#define UART_COMMAND_BULK 1     // mesh sends
+#define UART_COMMAND_QUEUED_CLASSES 2
+#define UART_COMMAND_LINK 2     // host link settings, executed right away in the rx task so framing switches in order
+
+#define UART_COMMAND_TABLE_BITS 6
+#define UART_COMMAND_TABLE_SIZE (1 << UART_COMMAND_TABLE_BITS) // max registered commands is one less
+
+/**
+ * @brief Command handler.
+ * 
+ * @param payload Pointer to the bytes after the 5 byte command.
+ * @param length Length of the payload, may be 0.
+ */
+typedef void (*uart_command_handler_t)(uint8_t* payload, size_t length);
+
+// actions behind the commands, provided by main.c on target and by stubs on host
+typedef struct {
+    int (*reply)(uint16_t node_addr, uint8_t* data, size_t length); // frame back to host
+    void (*send_network_info)(void);
+    void (*send_network_delta)(uint32_t epoch, uint32_t since_version);
+    void (*send_node_query)(uint16_t cursor, uint16_t fields, uint8_t max_nodes);
+    void (*send_pool_stats)(void);
+    void (*outbox)(uint8_t action); // CMD_OUTBOX_*, replies the outbox after the action
+    void (*send_message)(uint16_t node_addr, uint16_t length, uint8_t* data);
+    void (*send_tagged_message)(uint16_t request_id, uint16_t node_addr, bool require_response, uint16_t length, uint8_t* data);
+    void (*send_multi_message)(uint16_t* node_addrs, uint8_t node_count, uint16_t length, uint8_t* data); // addrs in host order
+    void (*broadcast_message)(uint16_t length, uint8_t* data);
+    void (*add_group_members)(uint16_t group_addr, uint16_t* node_addrs, uint16_t node_count);
+    void (*delete_group_members)(uint16_t group_addr, uint16_t* node_addrs, uint16_t node_count);
+    void (*send_group_message)(uint16_t group_addr, uint16_t length, uint8_t* data);
+    void (*transfer_open)(uint16_t node_addr, uint32_t total_length);
+    void (*transfer_write)(uint32_t offset, uint16_t length, uint8_t* data);
+    void (*transfer_abort)(void);
+    void (*set_node_ttl)(uint16_t node_addr, uint8_t ttl); // node addr 0 sets the default ttl
+    void (*restart)(void);
+    void (*reset_network)(void);
+    int (*request_baud_rate)(uint32_t baud_rate, bool hw_flow_ctrl);
+    int (*confirm_baud_rate)(void);
+    int (*set_link_mode)(uint8_t mode);
+    void (*benchmark)(void);
+} uart_command_ops_t;
+
+/**
+ * @brief Set the actions executed by commands and register the built-in commands.
+ * 
+ *  Must be called before uart_command_register() and uart_command_execute(), clears every registered command.
+ * 
+ * @param ops Pointer to the actions, kept by reference.
+ */
+void uart_command_init(const uart_command_ops_t* ops);
+
+/**
+ * @brief Register a command, lookup cost stays constant as commands are added.
+ * 
+ * @param verb 5 byte command, printable ascii.
+ * @param handler Handler invoked with the payload after the command.
+ * @param command_class UART_COMMAND_CONTROL, UART_COMMAND_BULK or UART_COMMAND_LINK.
+ * @return 0 on success, -1 if the verb is already registered or the table is full.
+ */
+int uart_command_register(const char* verb, uart_command_handler_t handler, uint8_t command_class);
+
+/**
+ * @brief Get the class of a command frame, used by the rx task to pick the queue.
+ * 
+ * @param command Pointer to the decoded frame content.
+ * @param length Length of the frame content.
+ * @return Class given at registration, UART_COMMAND_CONTROL for unknown or short commands.
+ */
+uint8_t uart_command_class(const uint8_t* command, size_t length);
+
+/**
+ * @brief Parse and execute one command, format | 5 byte command | payload |.
+ * 
+ * @param command Pointer to the decoded frame content.
+ * @param length Length of the frame content.
+ */
+void uart_command_execute(uint8_t* command, size_t length);
+
+#endif /* _UART_COMMAND_H_ */
@@ -0,0 +1,30 @@
+/* uart_transport.h - Byte transport under the host link framing */
+
+// board.c implements it on the uart driver, /host implements loopback and pty backends
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _UART_TRANSPORT_H_
+#define _UART_TRANSPORT_H_
+
+typedef struct {
+    /**
+     * @brief Write raw (already encoded) bytes.
+     * 
+     * @return Number of bytes written, -1 on error.
+     */
+    int (*write)(void* ctx, const uint8_t* data, size_t length);
+
+    /**
+     * @brief Read raw bytes, return as soon as any byte is available.
+     * 
+     * @param timeout_ms Max time to wait when nothing is available, 0 to poll.
+     * @return Number of bytes read, 0 on timeout, -1 on error.
+     */
+    int (*read)(void* ctx, uint8_t* data, size_t length, uint32_t timeout_ms);
+
+    void* ctx; // backend state, passed back on every call
+} uart_transport_t;
+
+#endif /* _UART_TRANSPORT_H_ */
@@ -0,0 +1,99 @@
+/* uart_tx_ring.c - Lock-free multi-producer ring buffer for uart tx records */
+
+#include <string.h>
+#include "uart_tx_ring.h"
+
+// header word layout: | committed (1 bit) | skip (1 bit) | unused (6 bit) | type (8 bit) | length (16 bit) |
+#define RECORD_COMMITTED    0x80000000u
+#define RECORD_SKIP         0x40000000u
+#define RECORD_TYPE(hdr)    (((hdr) >> 16) & 0xFF)
+#define RECORD_LENGTH(hdr)  ((hdr) & 0xFFFF)
+#define RECORD_SPAN(length) ((UART_TX_RING_HEADER_LEN + (length) + 3u) & ~3u) // header + data, 4 byte aligned
+
+static inline _Atomic uint32_t* ring_header(uart_tx_ring_t* ring, uint32_t position) {
+    return (_Atomic uint32_t*) (ring->buffer + (position & (ring->size - 1)));
+}
+
+void uart_tx_ring_init(uart_tx_ring_t* ring, uint8_t* buffer, uint32_t size) {
+    ring->buffer = buffer;
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+uint8_t* uart_tx_ring_reserve(uart_tx_ring_t* ring, uint16_t length, uint8_t type) {
+    uint32_t span = RECORD_SPAN(length);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t skip_len;
+
+    if (span > ring->size / 2) {
+        return NULL; // would not fit once padded for wrap around
+    }
+
+    do {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        uint32_t to_end = ring->size - (head & (ring->size - 1));
+
+        // record data is kept contiguous, pad to the start of the buffer when it would wrap
+        skip_len = (span > to_end ? to_end : 0);
+        if (head + skip_len + span - tail > ring->size) {
+            return NULL; // full
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&ring->head, &head, head + skip_len + span,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+
+    if (skip_len > 0) {
+        // padding carries no data, it's committed right away
+        atomic_store_explicit(ring_header(ring, head), RECORD_COMMITTED | RECORD_SKIP | skip_len, memory_order_release);
+        head += skip_len;
+    }
+
+    // header without committed bit, consumer keeps waiting on it until commit
+    atomic_store_explicit(ring_header(ring, head), ((uint32_t) type << 16) | length, memory_order_relaxed);
+    return ring->buffer + (head & (ring->size - 1)) + UART_TX_RING_HEADER_LEN;
+}
+
+void uart_tx_ring_commit(uart_tx_ring_t* ring, uint8_t* data) {
+    _Atomic uint32_t* header = (_Atomic uint32_t*) (data - UART_TX_RING_HEADER_LEN);
+    uint32_t header_word = atomic_load_explicit(header, memory_order_relaxed);
+
+    // release, record data written before is visible to the consumer once it sees the committed bit
+    atomic_store_explicit(header, header_word | RECORD_COMMITTED, memory_order_release);
+}
+
+const uint8_t* uart_tx_ring_peek(uart_tx_ring_t* ring, uint16_t* length, uint8_t* type) {
+    while (1) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+            return NULL; // empty
+        }
+
+        uint32_t header_word = atomic_load_explicit(ring_header(ring, tail), memory_order_acquire);
+        if (!(header_word & RECORD_COMMITTED)) {
+            return NULL; // oldest record still being written, keep order
+        }
+
+        if (header_word & RECORD_SKIP) {
+            uart_tx_ring_release(ring);
+            continue;
+        }
+
+        *length = RECORD_LENGTH(header_word);
+        *type = RECORD_TYPE(header_word);
+        return ring->buffer + (tail & (ring->size - 1)) + UART_TX_RING_HEADER_LEN;
+    }
+}
+
+void uart_tx_ring_release(uart_tx_ring_t* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t header_word = atomic_load_explicit(ring_header(ring, tail), memory_order_relaxed);
+    uint32_t span = (header_word & RECORD_SKIP) ? RECORD_LENGTH(header_word) : RECORD_SPAN(RECORD_LENGTH(header_word));
+
+    // zero the whole record, any word of it can be a header on the next lap and must read as uncommitted
+    memset(ring->buffer + (tail & (ring->size - 1)), 0, span);
+    atomic_store_explicit(&ring->tail, tail + span, memory_order_release);
+}
+
+bool uart_tx_ring_empty(uart_tx_ring_t* ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) == atomic_load_explicit(&ring->head, memory_order_acquire);
+}
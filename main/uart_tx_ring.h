@@ -0,0 +1,73 @@
+/* uart_tx_ring.h - Lock-free multi-producer ring buffer for uart tx records */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifndef _UART_TX_RING_H_
+#define _UART_TX_RING_H_
+
+#define UART_TX_RING_HEADER_LEN 4 // every record starts with a 4 byte aligned header word
+
+typedef struct {
+    uint8_t* buffer;        // 4 byte aligned storage
+    uint32_t size;          // power of 2
+    _Atomic uint32_t head;  // next reserve position, producers move it with compare-and-swap
+    _Atomic uint32_t tail;  // oldest unreleased position, only moved by the consumer
+} uart_tx_ring_t;
+
+/**
+ * @brief Initialize the ring on the provided storage.
+ * 
+ * @param ring Pointer to the ring.
+ * @param buffer Pointer to zeroed, 4 byte aligned storage.
+ * @param size Size of the storage, must be a power of 2.
+ */
+void uart_tx_ring_init(uart_tx_ring_t* ring, uint8_t* buffer, uint32_t size);
+
+/**
+ * @brief Reserve space for a record, safe to call from any number of tasks at once.
+ * 
+ *  Record is invisible to the consumer until uart_tx_ring_commit() is called on it.
+ *  Records are consumed in reservation order.
+ * 
+ * @param ring Pointer to the ring.
+ * @param length Length of the record data.
+ * @param type Application defined record type, returned by uart_tx_ring_peek().
+ * @return Pointer to contiguous record data, NULL if the ring is full.
+ */
+uint8_t* uart_tx_ring_reserve(uart_tx_ring_t* ring, uint16_t length, uint8_t type);
+
+/**
+ * @brief Publish a reserved record to the consumer.
+ * 
+ * @param ring Pointer to the ring.
+ * @param data Pointer returned by uart_tx_ring_reserve().
+ */
+void uart_tx_ring_commit(uart_tx_ring_t* ring, uint8_t* data);
+
+/**
+ * @brief Get the oldest record, consumer only.
+ * 
+ * @param ring Pointer to the ring.
+ * @param length Output, length of the record data.
+ * @param type Output, type of the record.
+ * @return Pointer to record data, NULL if the ring is empty or the oldest record is not committed yet.
+ */
+const uint8_t* uart_tx_ring_peek(uart_tx_ring_t* ring, uint16_t* length, uint8_t* type);
+
+/**
+ * @brief Release the record returned by the last uart_tx_ring_peek(), consumer only.
+ * 
+ * @param ring Pointer to the ring.
+ */
+void uart_tx_ring_release(uart_tx_ring_t* ring);
+
+/**
+ * @brief Check if every reserved record has been released.
+ * 
+ * @param ring Pointer to the ring.
+ */
+bool uart_tx_ring_empty(uart_tx_ring_t* ring);
+
+#endif /* _UART_TX_RING_H_ */